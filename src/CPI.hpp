@@ -3,8 +3,10 @@
 
 #include <vector>
 #include <cmath>
+#include <string>
 #include "include/LowerTriangle.hpp"
 #include "LogSumExp.hpp"
+#include "PairDistances.hpp"
 
 //---------------------------
 // Structure for calculating Coalescence Probability Index (CPI) using the softmax probabilities
@@ -13,41 +15,87 @@
 struct CPI {
     LowerTriangle<long double> lt;       // Lower triangle matrix storing calculated probabilities
     long double normalization_factor;    // Normalization factor for softmax probabilities
+    LogSumExp::Kernel softmax;           // exp of the normalization (LONG unless asked)
 
     // Constructor: Calculates CPI for the given agent characters using the specified parameter 's'
-    CPI(std::vector<std::vector<double>> agent_characters, long double s);
+    // the matrix is built in place, in a scratch file of backing_dir if it is not empty
+    CPI(const std::vector<std::vector<double>>& agent_characters, long double s, const std::string& backing_dir = "",
+        LogSumExp::Kernel softmax_ = LogSumExp::LONG);
+    // Same, reusing the storage of an existing matrix (no allocation when it has the right dimension)
+    CPI(const std::vector<std::vector<double>>& agent_characters, long double s, LowerTriangle<long double>&& storage, const std::string& backing_dir = "",
+        LogSumExp::Kernel softmax_ = LogSumExp::LONG);
+    // Same, from distances computed beforehand (shared between several s)
+    CPI(const PairDistances& distances, long double s, LowerTriangle<long double>&& storage, const std::string& backing_dir = "",
+        LogSumExp::Kernel softmax_ = LogSumExp::LONG);
 
     // Function to calculate the argument for the softmax function
-    long double softMaxArg(long double di, long double s);
+    static long double softMaxArg(long double di, long double s);
 
     // Function to calculate the Manhattan distance between two vectors
-    long double manh_distance(const std::vector<double>& a1, const std::vector<double>& a2);
+    static long double manh_distance(const std::vector<double>& a1, const std::vector<double>& a2);
 
-    // Function to set the LowerTriangle matrix based on softmax probabilities
-    void set_LT(const LogSumExp& SM);
+    // Function to set the diagonal to 0 and build the sampling index of the matrix
+    void set_LT();
+
+private:
+    // Fills lt with the softmax probabilities
+    void compute(const std::vector<std::vector<double>>& agent_characters, long double s);
+    void compute(const PairDistances& distances, long double s);
+    // Softmax of the arguments already in lt
+    void normalize();
 };
 
 // Inline implementations
 
 // Constructor implementation: Calculates CPI for the given agent characters using the specified parameter 's'
-inline CPI::CPI(std::vector<std::vector<double>> agent_characters, long double s) : lt(agent_characters.size()) {
-    std::vector<long double> x;
+inline CPI::CPI(const std::vector<std::vector<double>>& agent_characters, long double s, const std::string& backing_dir,
+                LogSumExp::Kernel softmax_)
+    : lt(agent_characters.size(), backing_dir), softmax(softmax_) {
+    compute(agent_characters, s);
+}
+
+inline CPI::CPI(const std::vector<std::vector<double>>& agent_characters, long double s, LowerTriangle<long double>&& storage, const std::string& backing_dir,
+                LogSumExp::Kernel softmax_)
+    : lt(std::move(storage)), softmax(softmax_) {
+    if (lt.dim != (int) agent_characters.size()) lt = LowerTriangle<long double>(agent_characters.size(), backing_dir);
+    compute(agent_characters, s);
+}
+
+inline CPI::CPI(const PairDistances& distances, long double s, LowerTriangle<long double>&& storage, const std::string& backing_dir,
+                LogSumExp::Kernel softmax_)
+    : lt(std::move(storage)), softmax(softmax_) {
+    if (lt.dim != distances.dim) lt = LowerTriangle<long double>(distances.dim, backing_dir);
+    compute(distances, s);
+}
 
+// Function implementation: Calculates the softmax probabilities into lt
+inline void CPI::compute(const std::vector<std::vector<double>>& agent_characters, long double s) {
     // Calculate arguments for softmax function based on pairwise Manhattan distances
-    for (int i = 0; i < agent_characters.size(); i++) {
+    // (written straight into the matrix, in the order of its indices)
+    long long index = 0;
+    int n = (int) agent_characters.size();
+    for (int i = 0; i < n; i++) {
         for (int j = 0; j <= i; j++) {
             long double ds = manh_distance(agent_characters[i], agent_characters[j]);
-            long double arg = softMaxArg(ds, s);
-            x.push_back(arg);
+            lt.arr[index] = softMaxArg(ds, s);
+            index++;
         }
     }
+    normalize();
+}
+
+inline void CPI::compute(const PairDistances& distances, long double s) {
+    for (long long index = 0; index < lt.size; index++) lt.arr[index] = softMaxArg(distances.get(index), s);
+    normalize();
+}
 
-    // Calculate softmax probabilities and normalization factor
-    LogSumExp SM = LogSumExp(x);
+inline void CPI::normalize() {
+    // Calculate softmax probabilities (in place) and normalization factor
+    LogSumExp SM = LogSumExp(lt.arr.data(), lt.size, softmax);
     normalization_factor = SM.y;
 
     // Set the LowerTriangle matrix using softmax probabilities
-    set_LT(SM);
+    set_LT();
 }
 
 // Function implementation: Calculates the argument for the softmax function
@@ -71,16 +119,12 @@ inline long double CPI::manh_distance(const std::vector<double>& a1, const std::
     return result;
 }
 
-// Function implementation: Sets the LowerTriangle matrix based on softmax probabilities
-inline void CPI::set_LT(const LogSumExp& SM) {
-    int index = 0;
-    for (auto pi : SM.pi) {
-        lt.set(index, pi);
-        index++;
-    }
-
+// Function implementation: Sets the diagonal to 0 and builds the sampling index
+inline void CPI::set_LT() {
     // Set diagonal elements to 0 in the LowerTriangle matrix
-    for (int i = 0; i < lt.dim; i++) lt.set(i, i, 0);
+    for (int i = 0; i < lt.dim; i++) lt.arr[lt.get_index(i, i)] = 0;
+
+    lt.rebuild_index();
 }
 
 #endif  // CPI_HEADER_H
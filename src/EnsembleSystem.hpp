@@ -0,0 +1,283 @@
+/*
+  Description: Ensemble engine for small systems. L independent realizations of the
+  same (D, N, s) run in lockstep, one per SIMD lane:
+
+    - the propensities of the lanes are interleaved (element k of lane l at k*L + l)
+      and kept in double instead of long double
+    - the selection scans the block sums of all the lanes at once, every lane
+      counting the blocks below its own target, then searches its single block
+    - the per lane updates (clock, cumulative, finished lanes) are masked by the
+      lanes that are still running
+    - a finished lane is refilled with a new realization by the caller (start)
+
+  Every lane follows exactly the dynamics of System.
+*/
+
+#ifndef ensemble_system_h
+#define ensemble_system_h
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include "include/RandomObject.hpp"
+
+
+
+template <int L> class EnsembleSystem{
+public:
+  static const int BS = 64; //elements per block of the selection index
+
+  //state of one realization
+  struct Lane{
+    bool active = false;
+    int rel = -1;           //realization number
+    RandomObject ro;
+    long double t = 0;
+    long double normalization_factor = 0;
+    int Nc = 0;
+    int step = 0;
+    bool moved = false;     //a link was made in the last step
+    bool done = false;      //the realization ended in the last step
+    std::pair<int, int> last_link;
+    std::vector<double> x;  //characters, agent major (N x D)
+    std::vector<std::vector<int>> cs;
+    std::vector<int> agent_location;
+  };
+
+  //hyper paramaters (input):
+  int D;
+  int N;
+  long double s;
+  bool INTERNAL;
+  long double R;
+
+  std::array<Lane, L> lanes;
+
+private:
+  long long size;
+  long long n_blocks;
+  std::vector<double> arr;        //interleaved propensities
+  std::vector<double> block_sum;  //interleaved block sums
+  std::vector<int> row_of;        //row and column of every element
+  std::vector<int> col_of;
+  alignas(64) double alpha[L];    //cumulative of every lane
+  alignas(64) double target[L];
+
+public:
+  EnsembleSystem(int D_, int N_, long double s_, bool INTERNAL_);
+
+  //starts realization rel in lane (draws its characters and computes its propensities)
+  void start(int lane, int rel, const RandomObject &ro);
+  //one Gillespie step of every active lane
+  void gilStep();
+  int n_active();
+
+private:
+  void aggregate(int lane, int a1, int a2);
+  void zero(int lane, long long index);
+  long long find(int lane, long long b, double val);
+  long long index(int r, int c) {return ((long long) r*(r+1))/2 + c;}
+};
+//-----------------------------------------------------------------------
+template <int L>
+EnsembleSystem<L>::EnsembleSystem(int D_, int N_, long double s_, bool INTERNAL_)
+  :D(D_),N(N_),s(s_),INTERNAL(INTERNAL_){
+
+    R =  2.0 / (1.0 * (N * (N)));
+    size = ((long long) N*(N+1))/2;
+    n_blocks = (size + BS - 1)/BS;
+    arr.assign(n_blocks*BS*L, 0.0);
+    block_sum.assign(n_blocks*L, 0.0);
+    row_of.resize(size);
+    col_of.resize(size);
+    for (int r = 0; r < N; r++) {
+        for (int c = 0; c <= r; c++) {
+            row_of[index(r,c)] = r;
+            col_of[index(r,c)] = c;
+        }
+    }
+    for (int l = 0; l < L; l++) {
+        alpha[l] = 0;
+        target[l] = -1;
+    }
+}
+//-----------------------------------------------------------------------
+template <int L>
+void EnsembleSystem<L>::start(int lane, int rel, const RandomObject &ro){
+    Lane &ln = lanes[lane];
+    ln.active = true;
+    ln.rel = rel;
+    ln.ro = ro;
+    ln.t = 0;
+    ln.Nc = N;
+    ln.step = 0;
+    ln.moved = false;
+    ln.done = false;
+
+    //same order of draws as SystemBase
+    ln.x.resize((size_t) N*D);
+    ln.cs.resize(N);
+    ln.agent_location.resize(N);
+    for (int i = 0; i < N; i++) {
+        for (int k = 0; k < D; k++) ln.x[(size_t) i*D + k] = ln.ro.get_double();
+        ln.cs[i].clear();
+        ln.cs[i].push_back(i);
+        ln.agent_location[i] = i;
+    }
+
+    //softmax of -s * distance as in CPI
+    double c = -HUGE_VAL;
+    for (int i = 0; i < N; i++) {
+        for (int j = 0; j <= i; j++) {
+            double d = 0;
+            for (int k = 0; k < D; k++) d += std::fabs(ln.x[(size_t) i*D + k] - ln.x[(size_t) j*D + k]);
+            double arg = -(double) s * (d / D);
+            arr[index(i,j)*L + lane] = arg;
+            c = std::max(c, arg);
+        }
+    }
+    double sum = 0;
+    for (long long k = 0; k < size; k++) sum += std::exp(arr[k*L + lane] - c);
+    double y = c + std::log(sum);
+    ln.normalization_factor = y;
+
+    for (long long k = 0; k < size; k++) arr[k*L + lane] = std::exp(arr[k*L + lane] - y);
+    for (int i = 0; i < N; i++) arr[index(i,i)*L + lane] = 0;
+
+    alpha[lane] = 0;
+    for (long long b = 0; b < n_blocks; b++) {
+        double bs = 0;
+        for (long long k = b*BS; k < std::min(size, (b+1)*BS); k++) bs += arr[k*L + lane];
+        block_sum[b*L + lane] = bs;
+        alpha[lane] += bs;
+    }
+}
+//-----------------------------------------------------------------------
+template <int L>
+void EnsembleSystem<L>::gilStep(){
+
+    //draws, clock and targets (lanes that are not running get no target)
+    for (int l = 0; l < L; l++) {
+        Lane &ln = lanes[l];
+        ln.moved = false;
+        ln.done = false;
+        target[l] = -1;
+        if (!ln.active) continue;
+
+        long double r1 = (long double)(ln.ro.get_double());
+        long double r2 = (long double)(ln.ro.get_double());
+        if (ln.Nc == 1) {
+            ln.done = true;
+            ln.active = false;
+            ln.step++;
+            continue;
+        }
+        ln.t += (1.0 / (1.0 * R * ln.normalization_factor)) * std::log(1.0 / (1.0 *r1));
+        target[l] = (double) r2 * alpha[l];
+    }
+
+    //every lane counts the blocks that stay below its target
+    alignas(64) double cum[L];
+    alignas(64) double before[L];
+    alignas(64) long long count[L];
+    for (int l = 0; l < L; l++) {
+        cum[l] = 0;
+        before[l] = 0;
+        count[l] = 0;
+    }
+    for (long long b = 0; b < n_blocks; b++) {
+        const double *bs = &block_sum[b*L];
+        #pragma omp simd
+        for (int l = 0; l < L; l++) {
+            cum[l] += bs[l];
+            bool below = cum[l] < target[l];
+            count[l] += below;
+            before[l] += below ? bs[l] : 0.0;
+        }
+    }
+
+    //every running lane searches its block and links
+    for (int l = 0; l < L; l++) {
+        if (!(target[l] >= 0)) continue;
+        alpha[l] = cum[l];
+        long long k = find(l, count[l], target[l] - before[l]);
+        aggregate(l, row_of[k], col_of[k]);
+        lanes[l].step++;
+        lanes[l].moved = true;
+    }
+}
+//-----------------------------------------------------------------------
+template <int L>
+int EnsembleSystem<L>::n_active(){
+    int n = 0;
+    for (int l = 0; l < L; l++) n += lanes[l].active;
+    return n;
+}
+//-----------------------------------------------------------------------
+template <int L>
+void EnsembleSystem<L>::aggregate(int lane, int a1, int a2){
+    Lane &ln = lanes[lane];
+    int c1 = ln.agent_location[a1];
+    int c2 = ln.agent_location[a2];
+    if (a1 == a2) throw std::invalid_argument("Out of bounds aggregation");
+    if (c1 == c2 && INTERNAL == false) throw std::invalid_argument("Internal links not allowed.");
+
+    ln.last_link.first = a1;
+    ln.last_link.second = a2;
+
+    if (INTERNAL == true) {
+        zero(lane, index(std::max(a1,a2), std::min(a1,a2)));
+    } else {
+        for (int i : ln.cs[c1]) {
+            for (int j : ln.cs[c2]) zero(lane, index(std::max(i,j), std::min(i,j)));
+        }
+    }
+
+    if (c1 != c2) {
+        ln.Nc--;
+        for (int j : ln.cs[c2]) {
+            ln.cs[c1].push_back(j);
+            ln.agent_location[j] = c1;
+        }
+        ln.cs[c2].clear();
+    }
+}
+//-----------------------------------------------------------------------
+template <int L>
+void EnsembleSystem<L>::zero(int lane, long long k){
+    double &a = arr[k*L + lane];
+    double &bs = block_sum[(k/BS)*L + lane];
+    //a block sum never goes below zero, the block count of the search relies on it
+    bs = std::max(0.0, bs - a);
+    alpha[lane] -= a;
+    a = 0;
+}
+//-----------------------------------------------------------------------
+// element of block b where the cumulative reaches val, falling back to the closest
+// positive element when rounding left val outside of the block
+template <int L>
+long long EnsembleSystem<L>::find(int lane, long long b, double val){
+    if (b < n_blocks) {
+        double cum = 0;
+        for (long long k = b*BS; k < std::min(size, (b+1)*BS); k++) {
+            double a = arr[k*L + lane];
+            cum += a;
+            if (cum >= val && a > 0) return k;
+        }
+    }
+    for (long long k = std::min(size, (b+1)*BS) - 1; k >= 0; k--) {
+        if (arr[k*L + lane] > 0) return k;
+    }
+    for (long long k = 0; k < size; k++) {
+        if (arr[k*L + lane] > 0) return k;
+    }
+    throw std::invalid_argument("No live pairs left");
+}
+
+
+
+
+#endif //ensemble_system_h
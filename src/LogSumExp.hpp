@@ -4,6 +4,10 @@
 #include <vector>    // For std::vector
 #include <algorithm> // For std::max_element
 #include <cmath>
+#include <stdexcept>
+#include <string>
+
+#include "include/FastExp.hpp"
 
 
 
@@ -11,15 +15,29 @@
 //         LOGSUMEXP
 //-----------------------------------------------------------------
 struct LogSumExp {
+    // LONG: std::exp on long double
+    // FAST: vectorized exp in double (FastExp, below 2 ulp) on blocks of BLOCK arguments,
+    //       the sums are kept in long double
+    enum Kernel {LONG, FAST};
+    static const int BLOCK = 2048;
+
     long double c;
     long double y;
     std::vector<long double> pi;
 
     LogSumExp(std::vector<long double> x);
+    // In place version: x is overwritten with pi (pi stays empty), avoids the copies
+    LogSumExp(long double *x, long long n, Kernel kernel = LONG);
 
     void calculate_y(std::vector<long double> x);
 
     void calculate_pi(std::vector<long double> x);
+
+    static Kernel parse(const std::string& name);
+    static std::string name(Kernel kernel);
+
+private:
+    void fast(long double *x, long long n);
 };
 
 // Inline implementations
@@ -30,6 +48,51 @@ inline LogSumExp::LogSumExp(std::vector<long double> x) {
     calculate_pi(x);
 }
 
+inline LogSumExp::LogSumExp(long double *x, long long n, Kernel kernel) {
+    c = *std::max_element(x, x + n);
+    if (kernel == FAST) {
+        fast(x, n);
+        return;
+    }
+    long double sum_to_log = 0;
+    for (long long i = 0; i < n; i++) {
+        sum_to_log += std::exp(x[i] - c);
+    }
+    y = c + std::log(sum_to_log);
+    for (long long i = 0; i < n; i++) {
+        x[i] = std::exp(x[i] - y);
+    }
+}
+
+// the arguments of a block are shifted in long double and exponentiated in double,
+// the block stays in L1 between the conversion and the exp
+inline void LogSumExp::fast(long double *x, long long n) {
+    double buf[BLOCK];
+    long double sum_to_log = 0;
+    for (long long b = 0; b < n; b += BLOCK) {
+        long long m = std::min((long long) BLOCK, n - b);
+        for (long long i = 0; i < m; i++) buf[i] = (double) (x[b + i] - c);
+        sum_to_log += FastExp::exp_sum(buf, m);
+    }
+    y = c + std::log(sum_to_log);
+    for (long long b = 0; b < n; b += BLOCK) {
+        long long m = std::min((long long) BLOCK, n - b);
+        for (long long i = 0; i < m; i++) buf[i] = (double) (x[b + i] - y);
+        FastExp::exp_sum(buf, m);
+        for (long long i = 0; i < m; i++) x[b + i] = buf[i];
+    }
+}
+
+inline LogSumExp::Kernel LogSumExp::parse(const std::string& name) {
+    if (name == "long") return LONG;
+    if (name == "fast") return FAST;
+    throw std::invalid_argument("unknown softmax kernel " + name);
+}
+
+inline std::string LogSumExp::name(Kernel kernel) {
+    return (kernel == LONG) ? "long" : "fast";
+}
+
 inline void LogSumExp::calculate_y(std::vector<long double> x) {
     long double sum_to_log = 0;
     for (int i = 0; i < x.size(); i++) {
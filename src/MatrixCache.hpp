@@ -0,0 +1,203 @@
+#ifndef matrix_cache_h
+#define matrix_cache_h
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "include/LowerTriangle.hpp"
+
+//---------------------------
+// On-disk cache of initialized propensity matrices. A file holds the characters, the
+// normalized matrix with its sampling index and the normalization factor; loading maps
+// the matrix copy on write, nothing is parsed or recomputed.
+//
+// The file name is a hash of the characters (they follow from the seed), N, D, s and the
+// kernel, the header and the characters are compared again when a file is loaded. Layout,
+// every section starting on a page:
+//   header | characters (N*D doubles) | arr (capacity of size) | block_sum
+// A file is written under a temporary name and renamed, readers never see a partial file.
+//--------------------------
+struct MatrixCache {
+    std::string dir;
+
+    MatrixCache(const std::string& dir_ = "") : dir(dir_) {}
+    bool enabled() const {return !dir.empty();}
+
+    // Loads the matrix of the characters into lt (false if it is not cached)
+    bool load(const std::vector<std::vector<double>>& characters, long double s, const std::string& kernel,
+              LowerTriangle<long double>& lt, long double& normalization_factor) const;
+    // Stores a normalized matrix, errors are ignored (the cache is only an optimization)
+    void store(const std::vector<std::vector<double>>& characters, long double s, const std::string& kernel,
+               const LowerTriangle<long double>& lt, long double normalization_factor) const;
+
+    std::string path(const std::vector<std::vector<double>>& characters, long double s, const std::string& kernel) const;
+
+private:
+    static const uint32_t VERSION = 1;
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t ld_size;           // sizeof(long double) of the writer
+        int64_t N, D;
+        int64_t size;               // elements of arr in use
+        int64_t n_blocks;           // elements of block_sum in use
+        int64_t chars_offset, arr_offset, block_offset, file_size;
+        long double normalization_factor;
+        long double cumulative;
+        char key[256];
+    };
+    static const long long HEADER_BYTES = 4096;
+
+    static std::string key(int N, int D, long double s, const std::string& kernel);
+    static std::vector<double> flatten(const std::vector<std::vector<double>>& characters);
+    static long long align(long long offset, long long page) {return ((offset + page - 1)/page)*page;}
+    static bool write_all(int fd, const void* p, size_t n, long long offset);
+};
+
+// Inline implementations
+
+inline std::string MatrixCache::key(int N, int D, long double s, const std::string& kernel) {
+    // s is written as text, the padding bytes of a long double are not part of the key
+    char buf[256];
+    std::snprintf(buf, sizeof(buf), "N=%d;D=%d;s=%.21Lg;kernel=%s;ld=%zu", N, D, s, kernel.c_str(), sizeof(long double));
+    return buf;
+}
+
+inline std::vector<double> MatrixCache::flatten(const std::vector<std::vector<double>>& characters) {
+    std::vector<double> out;
+    for (const std::vector<double>& c : characters) out.insert(out.end(), c.begin(), c.end());
+    return out;
+}
+
+inline std::string MatrixCache::path(const std::vector<std::vector<double>>& characters, long double s, const std::string& kernel) const {
+    // FNV-1a of the key and of the characters
+    uint64_t h = 1469598103934665603ULL;
+    auto mix = [&h](const void* p, size_t n) {
+        const unsigned char* b = (const unsigned char*) p;
+        for (size_t i = 0; i < n; i++) { h ^= b[i]; h *= 1099511628211ULL; }
+    };
+    int D = characters.empty() ? 0 : characters[0].size();
+    std::string k = key(characters.size(), D, s, kernel);
+    mix(k.data(), k.size());
+    for (const std::vector<double>& c : characters) mix(c.data(), c.size()*sizeof(double));
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.tpm", (unsigned long long) h);
+    return dir + "/" + name;
+}
+
+inline bool MatrixCache::load(const std::vector<std::vector<double>>& characters, long double s, const std::string& kernel,
+                              LowerTriangle<long double>& lt, long double& normalization_factor) const {
+    std::string file = path(characters, s, kernel);
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    Header h;
+    struct stat st;
+    bool ok = pread(fd, &h, sizeof(h), 0) == (ssize_t) sizeof(h) && fstat(fd, &st) == 0;
+    int D = characters.empty() ? 0 : characters[0].size();
+    long long page = sysconf(_SC_PAGESIZE);
+    ok = ok && std::memcmp(h.magic, "TPMCACHE", 8) == 0 && h.version == VERSION && h.ld_size == sizeof(long double)
+            && h.N == (int64_t) characters.size() && h.D == D && st.st_size >= h.file_size
+            && h.arr_offset % page == 0 && h.block_offset % page == 0;
+    h.key[sizeof(h.key)-1] = 0;
+    ok = ok && key(characters.size(), D, s, kernel) == h.key;
+
+    // a hash collision would have other characters
+    if (ok) {
+        std::vector<double> x = flatten(characters), cached(x.size());
+        ok = pread(fd, cached.data(), x.size()*sizeof(double), h.chars_offset) == (ssize_t) (x.size()*sizeof(double))
+             && std::memcmp(cached.data(), x.data(), x.size()*sizeof(double)) == 0;
+    }
+    close(fd);
+    if (!ok) return false;
+
+    MappedArray<long double> arr, block_sum;
+    try {
+        arr = MappedArray<long double>::map_private(file, h.arr_offset, h.size);
+        block_sum = MappedArray<long double>::map_private(file, h.block_offset, h.n_blocks);
+    }
+    catch (const std::invalid_argument&) {
+        return false;
+    }
+
+    if (lt.arr.is_file_backed()) {
+        // out of core: the values go to the scratch file, private copies of them could not be paged out
+        lt.resize(h.N);
+        std::memcpy(lt.arr.data(), arr.data(), h.size*sizeof(long double));
+        std::memcpy(lt.block_sum.data(), block_sum.data(), h.n_blocks*sizeof(long double));
+    }
+    else {
+        lt.arr = std::move(arr);
+        lt.block_sum = std::move(block_sum);
+    }
+    lt.dim = h.N;
+    lt.size = h.size;
+    lt.cumulative = h.cumulative;
+    if (!lt.part_sum.empty()) lt.partition(lt.part_sum.size());
+    normalization_factor = h.normalization_factor;
+    return true;
+}
+
+// pwrite writes at most about 2 GB at once
+inline bool MatrixCache::write_all(int fd, const void* p, size_t n, long long offset) {
+    const char* b = (const char*) p;
+    while (n > 0) {
+        ssize_t w = pwrite(fd, b, n, offset);
+        if (w <= 0) return false;
+        b += w; n -= w; offset += w;
+    }
+    return true;
+}
+
+inline void MatrixCache::store(const std::vector<std::vector<double>>& characters, long double s, const std::string& kernel,
+                               const LowerTriangle<long double>& lt, long double normalization_factor) const {
+    std::string file = path(characters, s, kernel);
+    std::vector<double> x = flatten(characters);
+    long long page = sysconf(_SC_PAGESIZE);
+    long long BLOCK = LowerTriangle<long double>::BLOCK;
+
+    Header h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, "TPMCACHE", 8);
+    h.version = VERSION;
+    h.ld_size = sizeof(long double);
+    h.N = characters.size();
+    h.D = characters.empty() ? 0 : characters[0].size();
+    h.size = lt.size;
+    h.n_blocks = lt.block_sum.size();
+    h.chars_offset = align(HEADER_BYTES, page);
+    // the mappings cover whole blocks
+    h.arr_offset = align(h.chars_offset + x.size()*sizeof(double), page);
+    h.block_offset = align(h.arr_offset + ((h.size + BLOCK - 1)/BLOCK)*BLOCK*sizeof(long double), page);
+    h.file_size = align(h.block_offset + ((h.n_blocks + BLOCK - 1)/BLOCK)*BLOCK*sizeof(long double), page);
+    h.normalization_factor = normalization_factor;
+    h.cumulative = lt.cumulative;
+    std::string k = key(h.N, h.D, s, kernel);
+    std::strncpy(h.key, k.c_str(), sizeof(h.key)-1);
+
+    std::string tmp = dir + "/.tpm.XXXXXX";
+    std::vector<char> name(tmp.begin(), tmp.end());
+    name.push_back(0);
+    int fd = mkstemp(name.data());
+    if (fd < 0) return;
+
+    // the gaps and the tails of the blocks are zero (ftruncate)
+    bool ok = ftruncate(fd, h.file_size) == 0
+              && write_all(fd, &h, sizeof(h), 0)
+              && write_all(fd, x.data(), x.size()*sizeof(double), h.chars_offset)
+              && write_all(fd, lt.arr.data(), h.size*sizeof(long double), h.arr_offset)
+              && write_all(fd, lt.block_sum.data(), h.n_blocks*sizeof(long double), h.block_offset);
+    close(fd);
+    if (!ok || std::rename(name.data(), file.c_str()) != 0) std::remove(name.data());
+}
+
+#endif  // matrix_cache_h
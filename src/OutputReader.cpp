@@ -0,0 +1,340 @@
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "OutputReader.hpp"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//  PARSING IN PLACE (every field is bounded by the end of its line)
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+static const char *line_end(const char *p, const char *end){
+    const char *nl = (const char*) std::memchr(p, '\n', end - p);
+    return nl ? nl : end;
+}
+
+template <typename T> static const char *field(const char *p, const char *end, T &value){
+    std::from_chars_result r = std::from_chars(p, end, value);
+    if(r.ec != std::errc()) throw std::invalid_argument("malformed line in output file");
+    return (r.ptr < end && *r.ptr == ',') ? r.ptr + 1 : r.ptr;
+}
+
+static const char *parse_link(const char *p, const char *end, Link &l){
+    const char *e = line_end(p, end);
+    p = field(p, e, l.a1);
+    p = field(p, e, l.a2);
+    p = field(p, e, l.step);
+    field(p, e, l.t);
+    return (e < end) ? e + 1 : e;
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//  PARTITION
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+Partition::Partition(const int32_t *base_, int N_, int Nc_): base(base_), N(N_), Nc(Nc_){}
+
+int Partition::find(int c) const{
+    auto it = parent.find(c);
+    while(it != parent.end()){
+        c = it->second;
+        it = parent.find(c);
+    }
+    return c;
+}
+
+int Partition::cluster(int i) const{
+    return find(base ? base[i] : i);
+}
+
+std::vector<int> Partition::labels() const{
+    std::vector<int> out(N);
+    for(int i=0; i<N; i++) out[i] = cluster(i);
+    return out;
+}
+
+void Partition::link(const Link &l){
+    if(l.a1 < 0 || l.a1 >= N || l.a2 < 0 || l.a2 >= N) throw std::invalid_argument("link to an unknown agent");
+    int c1 = cluster(l.a1), c2 = cluster(l.a2);
+    //the cluster keeps the name of its smallest member
+    if(c1 != c2){
+        parent[std::max(c1, c2)] = std::min(c1, c2);
+        Nc--;
+    }
+    links++;
+    t = l.t;
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//  LINKS
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+bool LinkCursor::next(Link &l){
+    if(p >= end) return false;
+    p = parse_link(p, end, l);
+    return true;
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//  OPENING A REALIZATION
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+void RealizationReader::stamp(const std::string &path, int64_t &size, int64_t &mtime_ns){
+    std::error_code ec;
+    size = std::filesystem::file_size(path, ec);
+    if(ec) throw std::invalid_argument("cant open " + path);
+    auto mt = std::filesystem::last_write_time(path, ec);
+    mtime_ns = ec ? 0 : std::chrono::duration_cast<std::chrono::nanoseconds>(mt.time_since_epoch()).count();
+}
+
+MappedArray<char> RealizationReader::map_file(const std::string &path){
+    int64_t size, mtime_ns;
+    stamp(path, size, mtime_ns);
+    if(size == 0) throw std::invalid_argument("empty file " + path);
+    return MappedArray<char>::map_private(path, 0, size);
+}
+
+RealizationReader::RealizationReader(const std::string &edge_path_): edge_path(edge_path_){
+    const std::string suffix = ".edge.csv";
+    if(edge_path.size() < suffix.size() || edge_path.compare(edge_path.size()-suffix.size(), suffix.size(), suffix) != 0){
+        throw std::invalid_argument("not an edge file: " + edge_path);
+    }
+    std::string prefix = edge_path.substr(0, edge_path.size()-suffix.size());
+    node_path = prefix + ".node.csv";
+    index_path = prefix + ".edge.idx";
+    open_system = std::filesystem::exists(prefix + ".event.csv");
+
+    //nodes: the header names the D characters, then one line per agent
+    nodes = map_file(node_path);
+    const char *p = nodes.data(), *end = p + nodes.size();
+    const char *e = line_end(p, end);
+    D = std::count(p, e, ',');
+    for(p = (e < end) ? e + 1 : e; p < end; p = line_end(p, end) + 1) N++;
+
+    //edges: header, the links, and the last link again with the steps and time of the end
+    edges = map_file(edge_path);
+    p = edges.data();
+    end = p + edges.size();
+    body = std::min(end, line_end(p, end) + 1);
+    e = end;
+    while(e > body && e[-1] == '\n') e--;
+    last = e;
+    while(last > body && last[-1] != '\n') last--;
+    if(last < e){
+        Link l;
+        parse_link(last, e, l);
+        steps = l.step;
+        t_end = l.t;
+    }
+    else last = end;
+
+    map_index();
+}
+
+LinkCursor RealizationReader::links() const{
+    return LinkCursor(body, last);
+}
+
+void RealizationReader::characters(std::vector<double> &out) const{
+    out.resize((size_t) N*D);
+    const char *p = nodes.data(), *end = p + nodes.size();
+    p = line_end(p, end) + 1;
+    for(int i=0; i<N; i++){
+        const char *e = line_end(p, end);
+        int label;
+        const char *q = field(p, e, label);
+        for(int j=0; j<D; j++) q = field(q, e, out[(size_t) i*D + j]);
+        p = e + 1;
+    }
+}
+
+long long RealizationReader::n_links() const{
+    if(has_index()) return header->n_links;
+    return std::count(body, last, '\n');
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//  INDEX
+//  header | labels (N int32 per checkpoint) | offsets | times | Nc, the sections on 64 bytes
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+static long long align64(long long offset){ return ((offset + 63)/64)*64; }
+
+static bool write_all(int fd, const void *p, size_t n, long long offset){
+    const char *b = (const char*) p;
+    while(n > 0){
+        ssize_t w = pwrite(fd, b, n, offset);
+        if(w <= 0) return false;
+        b += w; n -= w; offset += w;
+    }
+    return true;
+}
+
+void RealizationReader::write_index(int k){
+    if(k < 1) throw std::invalid_argument("the index needs k >= 1");
+    if(open_system) throw std::invalid_argument("realizations of open systems cannot be indexed");
+
+    int64_t edge_size, edge_mtime;
+    stamp(edge_path, edge_size, edge_mtime);
+
+    std::string tmp = index_path + ".XXXXXX";
+    std::vector<char> name(tmp.begin(), tmp.end());
+    name.push_back(0);
+    int fd = mkstemp(name.data());
+    if(fd < 0) throw std::invalid_argument("cant create " + tmp);
+    fchmod(fd, 0644);
+
+    //one pass: the union find gives every cluster the name of its smallest member
+    std::vector<int32_t> parent(N), labels(N);
+    for(int i=0; i<N; i++) parent[i] = i;
+    auto find = [&](int32_t a){
+        while(parent[a] != a){
+            parent[a] = parent[parent[a]];
+            a = parent[a];
+        }
+        return a;
+    };
+    std::vector<int64_t> offsets, nc;
+    std::vector<double> times;
+    long long labels_offset = HEADER_BYTES;
+    bool ok = true;
+    int Nc = N;
+    long long n = 0;
+    double t = 0;
+    auto checkpoint = [&](const char *position){
+        for(int i=0; i<N; i++) labels[i] = find(i);
+        ok = ok && write_all(fd, labels.data(), (size_t) N*sizeof(int32_t), labels_offset + (long long) offsets.size()*N*sizeof(int32_t));
+        offsets.push_back(position - edges.data());
+        times.push_back(t);
+        nc.push_back(Nc);
+    };
+
+    LinkCursor cursor = links();
+    Link l;
+    checkpoint(cursor.position());
+    while(ok && cursor.next(l)){
+        if(l.a1 < 0 || l.a1 >= N || l.a2 < 0 || l.a2 >= N){
+            close(fd);
+            std::remove(name.data());
+            throw std::invalid_argument("link to an unknown agent in " + edge_path);
+        }
+        int32_t r1 = find(l.a1), r2 = find(l.a2);
+        if(r1 != r2){
+            parent[std::max(r1, r2)] = std::min(r1, r2);
+            Nc--;
+        }
+        n++;
+        t = l.t;
+        if(n % k == 0) checkpoint(cursor.position());
+    }
+
+    IndexHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, "TPINDEX", 8);
+    h.version = VERSION;
+    h.k = k;
+    h.N = N;
+    h.n_links = n;
+    h.n_checkpoints = offsets.size();
+    h.edge_size = edge_size;
+    h.edge_mtime_ns = edge_mtime;
+    h.labels_offset = labels_offset;
+    h.offsets_offset = align64(labels_offset + h.n_checkpoints*N*sizeof(int32_t));
+    h.times_offset = align64(h.offsets_offset + h.n_checkpoints*sizeof(int64_t));
+    h.nc_offset = align64(h.times_offset + h.n_checkpoints*sizeof(double));
+    h.file_size = h.nc_offset + h.n_checkpoints*sizeof(int64_t);
+
+    ok = ok && write_all(fd, offsets.data(), offsets.size()*sizeof(int64_t), h.offsets_offset)
+            && write_all(fd, times.data(), times.size()*sizeof(double), h.times_offset)
+            && write_all(fd, nc.data(), nc.size()*sizeof(int64_t), h.nc_offset)
+            && write_all(fd, &h, sizeof(h), 0);
+    close(fd);
+    //readers see the old index or the new one, never a partial file
+    if(!ok || std::rename(name.data(), index_path.c_str()) != 0){
+        std::remove(name.data());
+        throw std::invalid_argument("cant write " + index_path);
+    }
+    map_index();
+}
+
+void RealizationReader::map_index(){
+    header = nullptr;
+    index.clear();
+    if(!std::filesystem::exists(index_path)) return;
+
+    int64_t edge_size, edge_mtime;
+    stamp(edge_path, edge_size, edge_mtime);
+    MappedArray<char> idx = map_file(index_path);
+    int64_t size = idx.size();
+    const IndexHeader *h = (const IndexHeader*) idx.data();
+    bool ok = size >= (int64_t) sizeof(IndexHeader) && std::memcmp(h->magic, "TPINDEX", 8) == 0 && h->version == VERSION
+              && h->N == N && h->k >= 1 && h->n_checkpoints >= 1 && h->file_size <= size
+              && h->edge_size == edge_size && h->edge_mtime_ns == edge_mtime;
+    //an index of an older edge file is not used
+    if(!ok) return;
+
+    index = std::move(idx);
+    header = (const IndexHeader*) index.data();
+    ck_labels = (const int32_t*) (index.data() + header->labels_offset);
+    ck_offset = (const int64_t*) (index.data() + header->offsets_offset);
+    ck_time = (const double*) (index.data() + header->times_offset);
+    ck_nc = (const int64_t*) (index.data() + header->nc_offset);
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//  QUERIES: from the checkpoint before, at most k links are replayed
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+Partition RealizationReader::checkpoint(long long c) const{
+    if(!has_index()) return Partition(nullptr, N, N);
+    Partition out(ck_labels + c*N, N, (int) ck_nc[c]);
+    out.links = c*header->k;
+    out.t = ck_time[c];
+    return out;
+}
+
+Partition RealizationReader::partition_at(double t) const{
+    if(open_system) throw std::invalid_argument("realizations of open systems cannot be queried");
+
+    //last checkpoint whose links all come before t (the times do not decrease)
+    long long c = 0;
+    if(has_index()) c = std::upper_bound(ck_time + 1, ck_time + header->n_checkpoints, t) - (ck_time + 1);
+
+    Partition out = checkpoint(c);
+    LinkCursor cursor(has_index() ? edges.data() + ck_offset[c] : body, last);
+    Link l;
+    while(cursor.next(l) && l.t <= t) out.link(l);
+    return out;
+}
+
+bool RealizationReader::merge_step(int i, int j, Link &out) const{
+    if(open_system) throw std::invalid_argument("realizations of open systems cannot be queried");
+    if(i < 0 || i >= N || j < 0 || j >= N) throw std::invalid_argument("unknown agent");
+    if(i == j){
+        out = Link{i, j, 0, 0};
+        return true;
+    }
+
+    //first checkpoint with i and j together, the link is in the k links before it
+    long long c = 0;
+    if(has_index()){
+        long long lo = 1, hi = header->n_checkpoints;
+        while(lo < hi){
+            long long mid = (lo + hi)/2;
+            const int32_t *lab = ck_labels + mid*N;
+            if(lab[i] == lab[j]) hi = mid;
+            else lo = mid + 1;
+        }
+        c = lo - 1;
+    }
+
+    Partition p = checkpoint(c);
+    LinkCursor cursor(has_index() ? edges.data() + ck_offset[c] : body, last);
+    Link l;
+    while(cursor.next(l)){
+        p.link(l);
+        if(p.cluster(i) == p.cluster(j)){
+            out = l;
+            return true;
+        }
+    }
+    out = Link{i, j, -1, 0};
+    return false;
+}
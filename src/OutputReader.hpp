@@ -0,0 +1,157 @@
+/*
+  Description: Reader of the csv files of a realization (library TPread).
+
+  The node and edge files are memory mapped and parsed in place: a link is read from
+  the mapping into a Link on the stack, nothing is allocated per line. Opening a
+  realization only counts the lines of its node file.
+
+  Replaying the links to get the clusters at some time costs O(links). An index next
+  to the edge file (<prefix>-<rel>.edge.idx, written by write_index) stores, every k
+  links, the clusters of every agent (its smallest member) with the byte offset of the
+  next link, the time and Nc. A query then starts from the checkpoint before it and
+  replays at most k links:
+
+    - partition_at(t): the clusters after the links up to time t
+    - merge_step(i, j): the link that put i and j in the same cluster (binary search
+      of the checkpoints, then at most k links)
+
+  The index is mapped as well. It is ignored when the edge file changed since it was
+  written (size or modification time). Realizations of open systems (with an event
+  file) have links between labels that come and go, they cannot be queried this way.
+*/
+
+#ifndef output_reader_h
+#define output_reader_h
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "include/MappedArray.hpp"
+
+
+
+//-----------------------------------------------------------------------
+// One line of an edge file
+//-----------------------------------------------------------------------
+struct Link{
+  int a1;
+  int a2;
+  long long step;
+  double t;
+};
+
+//-----------------------------------------------------------------------
+// Clusters at some point of a realization: the labels of a checkpoint (identity
+// without an index) and the merges of the links replayed after it
+//-----------------------------------------------------------------------
+class Partition{
+  const int32_t *base;                  //cluster of every agent at the checkpoint, null -> every agent alone
+  int N;
+  int Nc;
+  std::unordered_map<int, int> parent;  //clusters merged since the checkpoint (only the changed ones)
+
+  int find(int c) const;
+
+public:
+  long long links = 0;  //links replayed since the start of the realization
+  double t = 0;         //time of the last of them
+
+  Partition(const int32_t *base_, int N_, int Nc_);
+
+  //cluster of agent i, named after its smallest member
+  int cluster(int i) const;
+  int n_clusters() const {return Nc;}
+  int size() const {return N;}
+  //the cluster of every agent (O(N))
+  std::vector<int> labels() const;
+  //applies a link
+  void link(const Link &l);
+};
+
+//-----------------------------------------------------------------------
+// Links of an edge file, from a byte offset
+//-----------------------------------------------------------------------
+class LinkCursor{
+  const char *p;
+  const char *end;  //start of the last line (the end of the realization)
+public:
+  LinkCursor(const char *p_, const char *end_): p(p_), end(end_) {}
+  //false after the last link
+  bool next(Link &l);
+  //offset of the next link in the mapping
+  const char *position() const {return p;}
+};
+
+//-----------------------------------------------------------------------
+// The files of one realization
+//-----------------------------------------------------------------------
+class RealizationReader{
+public:
+  std::string edge_path;
+  std::string node_path;
+  std::string index_path;
+  int N = 0;                //agents
+  int D = 0;                //dimension of the characters
+  long long steps = 0;      //steps of the realization (last line of the edge file)
+  double t_end = 0;         //its final time
+  bool open_system = false; //an event file is next to the edge file
+
+  //path of the edge file, <prefix>-<rel>.edge.csv
+  RealizationReader(const std::string &edge_path_);
+
+  //every link, in order
+  LinkCursor links() const;
+  //characters of all the agents (N x D, row major)
+  void characters(std::vector<double> &out) const;
+
+  //writes the index (a checkpoint every k links) and uses it
+  void write_index(int k);
+  bool has_index() const {return header != nullptr;}
+  int index_interval() const {return has_index() ? (int) header->k : 0;}
+  long long n_links() const;
+
+  //clusters after the links up to time t (all of them for t >= t_end)
+  Partition partition_at(double t) const;
+  //link that put i and j in the same cluster into out, false (and step -1) if the
+  //realization ends with them apart
+  bool merge_step(int i, int j, Link &out) const;
+
+private:
+  MappedArray<char> edges;
+  MappedArray<char> nodes;
+  const char *body = nullptr;  //first link
+  const char *last = nullptr;  //last line
+
+  static const uint32_t VERSION = 1;
+  struct IndexHeader{
+    char magic[8];
+    uint32_t version;
+    uint32_t k;               //links between two checkpoints
+    int64_t N;
+    int64_t n_links;
+    int64_t n_checkpoints;    //checkpoint c: the first c*k links
+    int64_t edge_size;        //the edge file it was built from
+    int64_t edge_mtime_ns;
+    int64_t offsets_offset, times_offset, nc_offset, labels_offset, file_size;
+  };
+  static const long long HEADER_BYTES = 4096;
+  MappedArray<char> index;
+  const IndexHeader *header = nullptr;
+  const int64_t *ck_offset = nullptr;  //byte offset in the edge file of the first link after it
+  const double *ck_time = nullptr;     //time of the last link before it
+  const int64_t *ck_nc = nullptr;
+  const int32_t *ck_labels = nullptr;  //N per checkpoint
+
+  void map_index();
+  Partition checkpoint(long long c) const;
+  static MappedArray<char> map_file(const std::string &path);
+  //size and modification time of a file
+  static void stamp(const std::string &path, int64_t &size, int64_t &mtime_ns);
+};
+
+
+
+
+#endif //output_reader_h
@@ -0,0 +1,128 @@
+#ifndef pair_distances_h
+#define pair_distances_h
+
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "include/MappedArray.hpp"
+
+//---------------------------
+// Mean Manhattan distances of all the pairs of one character draw, in the index order of
+// LowerTriangle (i >= j). Computed once and shared by the propensities of several s.
+//
+// The characters are in [0,1) so the distances are too, they can be stored as:
+//   long   long double, the same values CPI computes itself
+//   double
+//   float  relative error below 6e-8
+//   u16    fixed point d*65535, absolute error below 7.7e-6 (the argument -s*d moves
+//          by less than s*7.7e-6)
+// They take as much room as a matrix at long, so they live in a MappedArray like it (scratch
+// files of backing_dir out of core) and count in the memory budget (bytes_needed).
+//--------------------------
+struct PairDistances {
+    enum Precision {LONG, DOUBLE, FLOAT, U16};
+
+    Precision precision;
+    int dim = 0;
+    long long size = 0;
+    bool ready = false;  // false -> not computed for the current characters
+    std::string backing_dir;  // empty -> memory, otherwise scratch files in this directory
+
+    MappedArray<long double> d_long;
+    MappedArray<double> d_double;
+    MappedArray<float> d_float;
+    MappedArray<uint16_t> d_u16;
+
+    PairDistances(const std::string& precision_ = "double");
+
+    // Computes the distances of the characters (no allocation when the size and the
+    // storage are unchanged)
+    void compute(const std::vector<std::vector<double>>& agent_characters);
+    long double get(long long index) const;
+    void clear() {ready = false;}
+    // storage of the next compute, the arrays of another storage are given back
+    void place(const std::string& backing_dir_);
+    void release();
+
+    static Precision parse(const std::string& name);
+    std::string name() const;
+    // memory of the distances of dim agents
+    static long double bytes_needed(int dim_, Precision precision_);
+};
+
+// Inline implementations
+
+inline PairDistances::PairDistances(const std::string& precision_)
+    : precision(parse(precision_)) {}
+
+inline void PairDistances::place(const std::string& backing_dir_) {
+    if (backing_dir_ == backing_dir) return;
+    release();
+    backing_dir = backing_dir_;
+}
+
+inline void PairDistances::release() {
+    d_long = MappedArray<long double>();
+    d_double = MappedArray<double>();
+    d_float = MappedArray<float>();
+    d_u16 = MappedArray<uint16_t>();
+    ready = false;
+}
+
+inline long double PairDistances::bytes_needed(int dim_, Precision precision_) {
+    static const int bytes[] = {sizeof(long double), sizeof(double), sizeof(float), sizeof(uint16_t)};
+    return 0.5L*dim_*(dim_+1.0L)*bytes[precision_];
+}
+
+inline PairDistances::Precision PairDistances::parse(const std::string& name) {
+    if (name == "long") return LONG;
+    if (name == "double") return DOUBLE;
+    if (name == "float") return FLOAT;
+    if (name == "u16") return U16;
+    throw std::invalid_argument("unknown distance precision " + name);
+}
+
+inline std::string PairDistances::name() const {
+    static const char* names[] = {"long", "double", "float", "u16"};
+    return names[precision];
+}
+
+inline void PairDistances::compute(const std::vector<std::vector<double>>& agent_characters) {
+    dim = agent_characters.size();
+    size = ((long long) dim*(dim+1))/2;
+    if (precision == LONG && d_long.size() != size) d_long = MappedArray<long double>(size, backing_dir);
+    else if (precision == DOUBLE && d_double.size() != size) d_double = MappedArray<double>(size, backing_dir);
+    else if (precision == FLOAT && d_float.size() != size) d_float = MappedArray<float>(size, backing_dir);
+    else if (precision == U16 && d_u16.size() != size) d_u16 = MappedArray<uint16_t>(size, backing_dir);
+
+    // same sum as CPI::manh_distance
+    long long index = 0;
+    for (int i = 0; i < dim; i++) {
+        const std::vector<double>& a1 = agent_characters[i];
+        for (int j = 0; j <= i; j++) {
+            const std::vector<double>& a2 = agent_characters[j];
+            long double d = 0.0;
+            for (size_t k = 0; k < a1.size(); k++) d += static_cast<long double>(std::abs(a1[k] - a2[k]));
+            d = d / static_cast<long double>(a1.size());
+
+            if (precision == LONG) d_long[index] = d;
+            else if (precision == DOUBLE) d_double[index] = (double) d;
+            else if (precision == FLOAT) d_float[index] = (float) d;
+            else d_u16[index] = (uint16_t) std::lround((double) d * 65535.0);
+            index++;
+        }
+    }
+    ready = true;
+}
+
+inline long double PairDistances::get(long long index) const {
+    if (precision == LONG) return d_long[index];
+    if (precision == DOUBLE) return d_double[index];
+    if (precision == FLOAT) return d_float[index];
+    return d_u16[index] / 65535.0L;
+}
+
+#endif  // pair_distances_h
@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "Reducers.hpp"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//  OPTIONS
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+std::vector<double> ReduceOptions::linear_grid(double t_max, int n){
+    if(n < 2 || !(t_max > 0)) throw std::invalid_argument("the grid needs t_max > 0 and 2 points or more");
+    std::vector<double> grid(n);
+    for(int i=0; i<n; i++) grid[i] = t_max*i/(n-1);
+    return grid;
+}
+
+std::vector<double> ReduceOptions::log_grid(double t_min, double t_max, int n){
+    if(n < 2 || !(t_min > 0) || !(t_max > t_min)) throw std::invalid_argument("the log grid needs 0 < t_min < t_max and 2 points or more");
+    std::vector<double> grid(n);
+    for(int i=0; i<n; i++) grid[i] = t_min*std::pow(t_max/t_min, (double) i/(n-1));
+    return grid;
+}
+
+std::vector<double> ReduceOptions::parse_grid(const std::string &spec){
+    std::vector<std::string> parts;
+    std::stringstream ss(spec);
+    std::string item;
+    while(std::getline(ss, item, ':')) parts.push_back(item);
+    if(parts.size()==2) return linear_grid(std::stod(parts[0]), std::stoi(parts[1]));
+    if(parts.size()==4 && parts[0]=="log") return log_grid(std::stod(parts[1]), std::stod(parts[2]), std::stoi(parts[3]));
+    throw std::invalid_argument("grid must be t_max:n or log:t_min:t_max:n");
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//  SUMMARY
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+// moments of two sets of realizations (Chan et al.)
+void EnsembleSummary::merge(const EnsembleSummary &other){
+    for(size_t g=0; g<grid.size(); g++){
+        long long na = nc_count[g], nb = other.nc_count[g];
+        if(nb == 0) continue;
+        double delta = other.nc_mean[g] - nc_mean[g];
+        long long n = na + nb;
+        nc_mean[g] += delta*nb/n;
+        nc_m2[g] += other.nc_m2[g] + delta*delta*((double) na*nb/n);
+        nc_count[g] = n;
+    }
+    final_times.insert(final_times.end(), other.final_times.begin(), other.final_times.end());
+    for(size_t b=0; b<distance_hist.size(); b++) distance_hist[b] += other.distance_hist[b];
+}
+
+double EnsembleSummary::nc_var(int g) const{
+    return (nc_count[g] > 1) ? nc_m2[g]/(nc_count[g]-1) : 0.0;
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//  ONE REALIZATION: Nc is followed with a union find
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+class ReducerRealization : public RealizationSink{
+    EnsembleSummary &acc;
+    int rel;
+    int N;
+    int D;
+    std::vector<double> x;
+    std::vector<int> parent;
+    std::vector<char> gone;     //roots of the clusters that left (open systems)
+    int Nc;
+    size_t g;           //next grid point
+    double t_last;      //time of the last link
+
+    int find(int a){
+        while(parent[a] != a){
+            parent[a] = parent[parent[a]];
+            a = parent[a];
+        }
+        return a;
+    }
+    void record(int Nc_, size_t g_end){
+        for(; g < g_end; g++){
+            acc.nc_count[g]++;
+            double delta = Nc_ - acc.nc_mean[g];
+            acc.nc_mean[g] += delta/acc.nc_count[g];
+            acc.nc_m2[g] += delta*(Nc_ - acc.nc_mean[g]);
+        }
+    }
+    //the grid points before an event still see the clusters before it
+    void advance(long double t){
+        size_t g_end = g;
+        while(g_end < acc.grid.size() && acc.grid[g_end] < (double) t) g_end++;
+        record(Nc, g_end);
+    }
+
+public:
+    ReducerRealization(EnsembleSummary &acc_, int rel_, int N_, int D_, const double *characters)
+        : acc(acc_), rel(rel_), N(N_), D(D_), x(characters, characters + (size_t) N_*D_), parent(N_), gone(N_, 0), Nc(N_), g(0), t_last(0){
+        for(int i=0; i<N; i++) parent[i] = i;
+    }
+    void link(int a1, int a2, int /*step*/, long double t) override{
+        advance(t);
+
+        if(!acc.distance_hist.empty()){
+            double d = 0;
+            for(int k=0; k<D; k++) d += std::fabs(x[(size_t) a1*D + k] - x[(size_t) a2*D + k]);
+            int bins = acc.distance_hist.size();
+            acc.distance_hist[std::min(bins-1, std::max(0, (int) (d/D*bins)))]++;
+        }
+
+        int r1 = find(a1), r2 = find(a2);
+        if(r1 != r2){
+            parent[r1] = r2;
+            Nc--;
+        }
+        t_last = (double) t;
+    }
+    //the labels of the arrivals follow the initial agents
+    void arrive(int label, int /*step*/, long double t, const double *character) override{
+        advance(t);
+        parent.push_back(label);
+        gone.push_back(0);
+        x.insert(x.end(), character, character + D);
+        Nc++;
+    }
+    //called for every agent of the cluster that leaves
+    void depart(int label, int /*step*/, long double t) override{
+        advance(t);
+        int r = find(label);
+        if(!gone[r]){
+            gone[r] = 1;
+            Nc--;
+        }
+    }
+    void end(int /*steps*/, long double /*t*/) override{
+        record(Nc, acc.grid.size());
+        acc.final_times.push_back({rel, t_last});
+    }
+};
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//  SINKS
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+ReducerSink::ReducerSink(const ReduceOptions &options_): options(options_){
+    if(options.distance_bins < 0) throw std::invalid_argument("negative number of bins");
+    if(!std::is_sorted(options.nc_grid.begin(), options.nc_grid.end())) throw std::invalid_argument("the grid must be increasing");
+}
+
+std::unique_ptr<RealizationSink> ReducerSink::start(int rel, int N, int D, const double *characters){
+    EnsembleSummary *acc;
+    {
+        std::lock_guard<std::mutex> lock(m);
+        std::unique_ptr<EnsembleSummary> &slot = accumulators[std::this_thread::get_id()];
+        if(!slot){
+            slot.reset(new EnsembleSummary());
+            slot->grid = options.nc_grid;
+            slot->nc_count.assign(options.nc_grid.size(), 0);
+            slot->nc_mean.assign(options.nc_grid.size(), 0);
+            slot->nc_m2.assign(options.nc_grid.size(), 0);
+            slot->distance_hist.assign(options.distance_bins, 0);
+        }
+        acc = slot.get();
+    }
+    return std::unique_ptr<RealizationSink>(new ReducerRealization(*acc, rel, N, D, characters));
+}
+
+EnsembleSummary ReducerSink::summary(){
+    std::lock_guard<std::mutex> lock(m);
+    EnsembleSummary out;
+    out.grid = options.nc_grid;
+    out.nc_count.assign(options.nc_grid.size(), 0);
+    out.nc_mean.assign(options.nc_grid.size(), 0);
+    out.nc_m2.assign(options.nc_grid.size(), 0);
+    out.distance_hist.assign(options.distance_bins, 0);
+    for(auto &a : accumulators) out.merge(*a.second);
+    std::sort(out.final_times.begin(), out.final_times.end());
+    return out;
+}
+
+void ReducerSink::write(const std::string &folder, const std::string &prefix){
+    EnsembleSummary sum = summary();
+    std::string base = folder+"/"+prefix;
+
+    if(!sum.grid.empty()){
+        std::ofstream f(base+".nc.csv");
+        if(!f.is_open()) throw std::invalid_argument("error opening summary file");
+        f << "Time,Mean,Var,Count" << std::endl;
+        for(size_t g=0; g<sum.grid.size(); g++){
+            f << sum.grid[g] << "," << sum.nc_mean[g] << "," << sum.nc_var(g) << "," << sum.nc_count[g] << std::endl;
+        }
+    }
+    {
+        std::ofstream f(base+".final_time.csv");
+        if(!f.is_open()) throw std::invalid_argument("error opening summary file");
+        f << "Rel,Time" << std::endl;
+        for(auto &ft : sum.final_times) f << ft.first << "," << ft.second << std::endl;
+    }
+    if(!sum.distance_hist.empty()){
+        std::ofstream f(base+".merge_distance.csv");
+        if(!f.is_open()) throw std::invalid_argument("error opening summary file");
+        f << "Low,High,Count" << std::endl;
+        int bins = sum.distance_hist.size();
+        for(int b=0; b<bins; b++) f << (double) b/bins << "," << (double) (b+1)/bins << "," << sum.distance_hist[b] << std::endl;
+    }
+}
+//-----------------------------------------------------------------------
+class TeeRealization : public RealizationSink{
+    std::vector<std::unique_ptr<RealizationSink>> outs;
+public:
+    TeeRealization(std::vector<std::unique_ptr<RealizationSink>> &&outs_): outs(std::move(outs_)){}
+    void link(int a1, int a2, int step, long double t) override{
+        for(auto &o : outs) o->link(a1, a2, step, t);
+    }
+    void arrive(int label, int step, long double t, const double *character) override{
+        for(auto &o : outs) o->arrive(label, step, t, character);
+    }
+    void depart(int label, int step, long double t) override{
+        for(auto &o : outs) o->depart(label, step, t);
+    }
+    void end(int steps, long double t) override{
+        for(auto &o : outs) o->end(steps, t);
+    }
+};
+
+TeeSink::TeeSink(const std::vector<SimSink*> &sinks_): sinks(sinks_){}
+
+std::unique_ptr<RealizationSink> TeeSink::start(int rel, int N, int D, const double *characters){
+    std::vector<std::unique_ptr<RealizationSink>> outs;
+    for(SimSink *s : sinks) outs.push_back(s->start(rel, N, D, characters));
+    return std::unique_ptr<RealizationSink>(new TeeRealization(std::move(outs)));
+}
@@ -0,0 +1,86 @@
+/*
+  Description: Ensemble reducers (library TPsim). A ReducerSink is a SimSink that keeps
+  summaries of all the realizations instead of their links:
+
+    - mean and variance of Nc(t) on a time grid
+    - the final merge time of every realization
+    - the histogram of the distances between linked agents
+
+  Every thread accumulates into its own Accumulator (the lock is only taken when a thread
+  starts its first realization), the accumulators are merged by summary() once the run
+  is over. Nc is followed from the links with a union find, so any engine (and the C
+  callbacks) can feed it.
+*/
+
+#ifndef reducers_h
+#define reducers_h
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Simulation.hpp"
+
+
+
+//-----------------------------------------------------------------------
+// What is reduced
+//-----------------------------------------------------------------------
+struct ReduceOptions{
+  std::vector<double> nc_grid;  //times of the Nc(t) grid, increasing (empty -> no Nc(t))
+  int distance_bins = 50;       //bins of the merge distance histogram over [0, 1]
+
+  static std::vector<double> linear_grid(double t_max, int n);
+  static std::vector<double> log_grid(double t_min, double t_max, int n);
+  //"t_max:n" or "log:t_min:t_max:n"
+  static std::vector<double> parse_grid(const std::string &spec);
+};
+
+//-----------------------------------------------------------------------
+// Result of the reduction
+//-----------------------------------------------------------------------
+struct EnsembleSummary{
+  std::vector<double> grid;
+  std::vector<long long> nc_count;    //realizations seen at every grid point
+  std::vector<double> nc_mean;
+  std::vector<double> nc_m2;          //sum of squared deviations (variance = m2/(count-1))
+  std::vector<std::pair<int, double>> final_times;  //(realization, time of the last merge)
+  std::vector<long long> distance_hist;
+
+  void merge(const EnsembleSummary &other);
+  double nc_var(int g) const;
+};
+
+//-----------------------------------------------------------------------
+// The sink
+//-----------------------------------------------------------------------
+class ReducerSink : public SimSink{
+  ReduceOptions options;
+  std::mutex m;
+  std::map<std::thread::id, std::unique_ptr<EnsembleSummary>> accumulators;
+
+public:
+  ReducerSink(const ReduceOptions &options_);
+  std::unique_ptr<RealizationSink> start(int rel, int N, int D, const double *characters) override;
+
+  //merges the accumulators of all the threads (call once the run is over)
+  EnsembleSummary summary();
+  //writes folder/prefix.nc.csv, .final_time.csv and .merge_distance.csv
+  void write(const std::string &folder, const std::string &prefix);
+};
+
+// Hands every realization to several sinks (e.g. the csv files and a reducer)
+class TeeSink : public SimSink{
+  std::vector<SimSink*> sinks;
+public:
+  TeeSink(const std::vector<SimSink*> &sinks_);
+  std::unique_ptr<RealizationSink> start(int rel, int N, int D, const double *characters) override;
+};
+
+
+
+
+#endif //reducers_h
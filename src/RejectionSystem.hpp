@@ -0,0 +1,174 @@
+/*
+  Description: Matrix free engine for any s by rejection. Every propensity is bounded:
+  exp(-s d) <= exp(shift), shift = max(0, -s), since the distances are in [0, 1]. So a
+  link is drawn as
+
+    - a uniform pair among the pairs that can link (the cluster bookkeeping of
+      UniformSystem keeps their counts)
+    - accepted with probability exp(-s d - shift), d recomputed from the characters,
+      otherwise a new pair is proposed
+
+  which selects the pair with probability proportional to its propensity, as in System.
+  The clock is the one of System: one time step per link, with the normalization factor
+  of the initial matrix (computed once per realization, row by row, in O(N) memory).
+
+  Memory is O(N D) and a step costs 1/acceptance proposals of O(D). The acceptance falls
+  with s and as the close pairs link first; once it falls below min_acceptance (measured
+  over the last WINDOW proposals) the realization goes on with a stored matrix (System
+  built from the current clusters) for the rest of its links.
+*/
+
+#ifndef rejection_system_h
+#define rejection_system_h
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "include/FastExp.hpp"
+#include "include/RandomObject.hpp"
+#include "CPI.hpp"
+#include "System.hpp"
+#include "UniformSystem.hpp"
+
+
+
+class RejectionSystem : public UniformSystem{
+public:
+  static const long long WINDOW = 4096;  //proposals between two checks of the acceptance
+
+  double min_acceptance = 0.01;  //below it the realization switches to a matrix (0 -> never)
+  std::string backing_dir;       //storage of the matrix
+  MatrixOptions options;
+  //statistics of the current realization
+  long long proposals = 0;
+  long long accepted = 0;
+
+public:
+  //options.softmax is the exp of the normalization, the rest goes to the matrix of a switch
+  RejectionSystem(int D_, int N_, long double s_,bool INTERNAL_,RandomObject &ro_, const MatrixOptions &options_ = MatrixOptions());
+
+  bool gilStep() override;
+  void reinitialize(unsigned long long seed) override;
+  //(the matrix of a switch is not shared)
+  std::unique_ptr<SystemBase> clone(RandomObject &) override {throw std::invalid_argument("the rejection engine cannot be cloned");}
+
+  //true once the realization went on with the matrix
+  bool switched() const {return matrix != nullptr;}
+  double acceptance() const {return (proposals > 0) ? (double) accepted / proposals : 1.0;}
+
+private:
+  long double shift;                 //bound of the softmax arguments
+  std::vector<double> row;           //scratch row of the normalization
+  std::unique_ptr<System> matrix;    //the rest of the realization, after a switch
+  long long window_proposals = 0;
+  long long window_accepted = 0;
+
+  void initNormalization();
+  void switchToMatrix();
+
+};
+//-----------------------------------------------------------------------
+inline RejectionSystem::RejectionSystem(int D_, int N_, long double s_,bool INTERNAL_,RandomObject &ro_, const MatrixOptions &options_)
+  :UniformSystem(D_,N_,s_,INTERNAL_,ro_,true),options(options_){
+
+    initNormalization();
+}
+//-----------------------------------------------------------------------
+inline bool RejectionSystem::gilStep() {
+
+  long double r1 = (long double)(ro->get_double());
+  long double r2 = (long double)(ro->get_double());
+
+  if (Nc ==1) {
+        return false;
+  }
+
+  t += time_step(r1);
+
+  if (matrix) {
+    //the matrix selects, both systems follow the link
+    matrix->link(r2 * matrix->cp.get_cum());
+    aggregate(matrix->last_link.first, matrix->last_link.second);
+    return true;
+  }
+
+  //Event Selection + Action
+  long double r = r2;
+  while (true) {
+    int a1, a2;
+    uniform_pair(r, a1, a2);
+    proposals++;
+    window_proposals++;
+    long double p = std::exp(CPI::softMaxArg(CPI::manh_distance(agent_characters[a1], agent_characters[a2]), s) - shift);
+    if (ro->get_double() < p) {
+      accepted++;
+      window_accepted++;
+      aggregate(a1, a2);
+      return true;
+    }
+
+    if (window_proposals >= WINDOW) {
+      if (window_accepted < min_acceptance * window_proposals) {
+        //r2 went into a rejected proposal, the matrix gets a fresh number
+        switchToMatrix();
+        matrix->link((long double)(ro->get_double()) * matrix->cp.get_cum());
+        aggregate(matrix->last_link.first, matrix->last_link.second);
+        return true;
+      }
+      window_proposals = 0;
+      window_accepted = 0;
+    }
+    r = (long double)(ro->get_double());
+  }
+}
+//-----------------------------------------------------------------------
+inline void RejectionSystem::switchToMatrix(){
+  matrix.reset(new System(*this, backing_dir, options));
+  if (INTERNAL == true) {
+    for (long long k : linked) matrix->cp.set((int) (k / N), (int) (k % N), 0);
+  }
+}
+//-----------------------------------------------------------------------
+inline void RejectionSystem::reinitialize(unsigned long long seed){
+  matrix.reset();
+  UniformSystem::reinitialize(seed);
+  initNormalization();
+}
+//-----------------------------------------------------------------------
+inline void RejectionSystem::initNormalization(){
+  proposals = 0;
+  accepted = 0;
+  window_proposals = 0;
+  window_accepted = 0;
+
+  //log of the sum of exp(-s d) over the pairs, the diagonal (d = 0) included, as in CPI
+  //(with the exp of options.softmax)
+  shift = std::max((long double) 0, -s);
+  long double sum = N * std::exp(-shift);
+  if (options.softmax == LogSumExp::FAST) {
+    row.resize(N);
+    for (int i = 1; i < N; i++) {
+      for (int j = 0; j < i; j++) {
+        row[j] = (double) (CPI::softMaxArg(CPI::manh_distance(agent_characters[i], agent_characters[j]), s) - shift);
+      }
+      sum += FastExp::exp_sum(row.data(), i);
+    }
+  }
+  else {
+    for (int i = 1; i < N; i++) {
+      for (int j = 0; j < i; j++) {
+        sum += std::exp(CPI::softMaxArg(CPI::manh_distance(agent_characters[i], agent_characters[j]), s) - shift);
+      }
+    }
+  }
+  normalization_factor = shift + std::log(sum);
+}
+
+
+
+
+#endif //rejection_system_h
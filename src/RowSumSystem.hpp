@@ -0,0 +1,229 @@
+/*
+  Description: Matrix free engine. Only the live propensity of every agent's row is
+  stored (in a sum tree), the row of the selected agent is recomputed from the
+  characters when it is needed:
+
+    - agent i is selected with probability row_i / sum(row)
+    - its partner j with probability p_ij / row_i
+
+  every pair is in two rows, so the pair (i,j) is selected with probability
+  2 p_ij / sum(row), the same as in System. Memory is O(N D) instead of O(N^2),
+  every step costs one O(N D) row recomputation.
+*/
+
+#ifndef row_sum_system_h
+#define row_sum_system_h
+
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "include/RandomObject.hpp"
+#include "include/SumTree.hpp"
+#include "SystemBase.hpp"
+
+
+
+class RowSumSystem : public SystemBase{
+public:
+  //characters stored column major (D x N), a row is recomputed with unit stride
+  std::vector<double> xt;
+  //live propensity of every row
+  SumTree<double> row_sums;
+  //pairs already linked (only used with INTERNAL links)
+  std::vector<std::vector<int>> linked;
+
+private:
+  std::vector<double> row;  //scratch row
+  double shift;             //upper bound of the softmax arguments
+
+public:
+  RowSumSystem(int D_, int N_, long double s_,bool INTERNAL_,RandomObject &ro_);
+
+  void aggregate(int a1, int a2);
+  bool gilStep() override;
+  void reinitialize(unsigned long long seed) override;
+  std::unique_ptr<SystemBase> clone(RandomObject &ro_) override;
+
+  //propensity of the pair, not checking if it is still live
+  double weight(int a1, int a2);
+  //fills row with the live propensities of agent i and returns their sum
+  double compute_row(int i);
+
+private:
+  void initRows();
+  void distances(int i, int n);
+
+};
+//-----------------------------------------------------------------------
+inline RowSumSystem::RowSumSystem(int D_, int N_, long double s_,bool INTERNAL_,RandomObject &ro_)
+  :SystemBase(D_,N_,s_,INTERNAL_,ro_),row_sums(N_){
+
+    if (INTERNAL) linked.resize(N);
+    initRows();
+}
+//-----------------------------------------------------------------------
+inline void RowSumSystem::aggregate(int a1, int a2) {
+    int c1 = agent_location[a1];
+    int c2 = agent_location[a2];
+    if (c1 == c2 && INTERNAL == false) throw std::invalid_argument("Internal links not allowed.");
+
+    last_link.first=a1;
+    last_link.second =a2;
+
+    if (INTERNAL == true) {
+        // only the linked pair stops being live
+        double w = weight(a1, a2);
+        row_sums.set(a1, std::max(0.0, row_sums.get(a1) - w));
+        row_sums.set(a2, std::max(0.0, row_sums.get(a2) - w));
+        linked[a1].push_back(a2);
+        linked[a2].push_back(a1);
+    } else {
+        // every pair between the two clusters stops being live
+        members(c1, members1);
+        members(c2, members2);
+        for (int b : members2) row[b] = 0;
+        for (int a : members1) {
+            double removed1 = 0;
+            for (int b : members2) {
+                double w = weight(a, b);
+                removed1 += w;
+                row[b] += w;
+            }
+            row_sums.set(a, std::max(0.0, row_sums.get(a) - removed1));
+        }
+        for (int b : members2) {
+            row_sums.set(b, std::max(0.0, row_sums.get(b) - row[b]));
+        }
+    }
+
+    if (c1 != c2) merge_clusters(c1, c2);
+}
+//-----------------------------------------------------------------------
+inline bool RowSumSystem::gilStep() {
+
+  long double r1 = (long double)(ro->get_double());
+  long double r2 = (long double)(ro->get_double());
+
+  if (Nc ==1) {
+        return false;
+  }
+
+  t += time_step(r1);
+
+  //Event Selection + Action
+  while (true) {
+    double total = row_sums.total();
+    if (!(total > 0)) throw std::invalid_argument("No live pairs left");
+
+    int i = row_sums.sample(r2 * total);
+    //the stored row sum is corrected with the exact one
+    double exact = compute_row(i);
+    row_sums.set(i, exact);
+
+    if (exact > 0) {
+      double val = ro->get_double() * exact;
+      double cum = 0;
+      int j = -1;
+      for (int k = 0; k < N; k++) {
+        if (!(row[k] > 0)) continue;
+        cum += row[k];
+        j = k;
+        if (cum >= val) break;
+      }
+      aggregate(i, j);
+      return true;
+    }
+    //the row was only left over by rounding, select again
+    r2 = (long double)(ro->get_double());
+  }
+}
+//-----------------------------------------------------------------------
+inline std::unique_ptr<SystemBase> RowSumSystem::clone(RandomObject &ro_){
+    RowSumSystem *c = new RowSumSystem(*this);
+    c->ro = &ro_;
+    return std::unique_ptr<SystemBase>(c);
+}
+//-----------------------------------------------------------------------
+inline void RowSumSystem::reinitialize(unsigned long long seed){
+    SystemBase::reinitialize(seed);
+    for (auto &l : linked) l.clear();
+    initRows();
+}
+//-----------------------------------------------------------------------
+inline double RowSumSystem::weight(int a1, int a2){
+    double d = 0;
+    for (int k = 0; k < D; k++) d += std::fabs(xt[k*N + a1] - xt[k*N + a2]);
+    return std::exp(-(double) s * (d / D) - (double) normalization_factor);
+}
+//-----------------------------------------------------------------------
+inline double RowSumSystem::compute_row(int i){
+    distances(i, N);
+
+    double y = (double) normalization_factor;
+    double sd = (double) s / D;
+    for (int j = 0; j < N; j++) row[j] = std::exp(-sd * row[j] - y);
+
+    //masking the pairs that are not live anymore
+    if (INTERNAL == true) {
+        row[i] = 0;
+        for (int j : linked[i]) row[j] = 0;
+    } else {
+        int ci = agent_location[i];
+        for (int j = 0; j < N; j++) row[j] = (agent_location[j] != ci) ? row[j] : 0.0;
+    }
+
+    double sum = 0;
+    for (int j = 0; j < N; j++) sum += row[j];
+    return sum;
+}
+//-----------------------------------------------------------------------
+// sum of the absolute differences between agent i and the first n agents
+inline void RowSumSystem::distances(int i, int n){
+    for (int j = 0; j < n; j++) row[j] = 0;
+    for (int k = 0; k < D; k++) {
+        const double *col = &xt[(size_t) k*N];
+        double xi = col[i];
+        for (int j = 0; j < n; j++) row[j] += std::fabs(col[j] - xi);
+    }
+}
+//-----------------------------------------------------------------------
+inline void RowSumSystem::initRows(){
+    xt.resize((size_t) D*N);
+    row.resize(N);
+    for (int i = 0; i < N; i++) {
+        for (int k = 0; k < D; k++) xt[(size_t) k*N + i] = agent_characters[i][k];
+    }
+
+    //the mean distance is in [0,1] so -s*d is never above the shift
+    shift = (s >= 0) ? 0.0 : -(double) s;
+
+    //one pass over the pairs for both the normalization and the row sums
+    //(accumulated unscaled in the leaves)
+    for (int i = 0; i < N; i++) row_sums.set_leaf(i, 0.0);
+    double total = 0;
+    double sd = (double) s / D;
+    for (int i = 1; i < N; i++) {
+        distances(i, i);
+        double row_i = 0;
+        for (int j = 0; j < i; j++) {
+            double e = std::exp(-sd * row[j] - shift);
+            row_i += e;
+            row_sums.set_leaf(j, row_sums.get(j) + e);
+        }
+        row_sums.set_leaf(i, row_sums.get(i) + row_i);
+        total += row_i;
+    }
+    //the diagonal (distance 0) is part of the normalization as in CPI
+    normalization_factor = shift + std::log(N * std::exp(-shift) + total);
+
+    double scale = std::exp(shift - (double) normalization_factor);
+    for (int i = 0; i < N; i++) row_sums.set_leaf(i, row_sums.get(i) * scale);
+    row_sums.rebuild();
+}
+
+
+
+
+#endif //row_sum_system_h
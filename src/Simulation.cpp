@@ -0,0 +1,709 @@
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(_OPENMP)
+   #include <omp.h>
+#endif
+
+#include "include/Placement.hpp"
+#include "include/RandomObject.hpp"
+#include "include/utils.hpp"
+
+#include "Simulation.hpp"
+#include "Telemetry.hpp"
+#include "System.hpp"
+#include "RowSumSystem.hpp"
+#include "UniformSystem.hpp"
+#include "RejectionSystem.hpp"
+#include "EnsembleSystem.hpp"
+
+//----------------------------------------------
+static std::unique_ptr<SystemBase> make_system(const SimParams &p, RandomObject &ro, const std::string &backing_dir, PairDistances *distances,
+                                               const std::vector<int> &cpus);
+static void run_sim(const SimParams &p, int rel, SimSink &sink, const std::string &backing_dir, WorkerStatus *status);
+static void run_sweep_rel(const SimParams &p, const std::vector<long double> &s_values, int rel, const std::vector<SimSink*> &sinks,
+                          const std::string &backing_dir, WorkerStatus *status);
+static void run_realization(SystemBase &sys, int rel, SimSink &sink, WorkerStatus *status);
+static void run_cloned(const SimParams &p, int rel, SimSink &sink, WorkerStatus *status);
+static bool run_steps(SystemBase &sys, RealizationSink &out, int &counter, int rel, long long steps0, WorkerStatus *status,
+                      const SimParams *clone_at = nullptr);
+static void finish_realization(SystemBase &sys, RealizationSink &out, int counter, long long steps0, WorkerStatus *status);
+template <int L> static void run_ensemble(const SimParams &p, SimSink &sink, std::atomic<int> &next_rel, WorkerStatus *status);
+static void check_params(const SimParams &p);
+static unsigned long long realization_seed(const SimParams &p, int rel);
+static int worker_id();
+static std::vector<int> worker_cpus(const SimParams &p, const std::vector<Placement::Cpu> &cpus, int worker);
+
+// pins a worker thread (with --pin) for the time of a run, its team gets the next cpus
+class WorkerPlacement{
+    AffinityGuard guard;
+public:
+    WorkerPlacement(const SimParams &p, const std::vector<Placement::Cpu> &cpus);
+    ~WorkerPlacement();
+};
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//  RUNNING ALL THE REALIZATIONS OF ONE PARAMETER SET
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+void run_simulation(const SimParams &p, SimSink &sink){
+
+    check_params(p);
+
+    std::string backing_dir = propensity_storage(p);
+    if(backing_dir.length()>0) std::filesystem::create_directories(backing_dir);
+    if(p.matrix_cache.length()>0) std::filesystem::create_directories(p.matrix_cache);
+
+    //exceptions cannot leave an OpenMP region, the first one is kept and rethrown
+    std::exception_ptr error = nullptr;
+    std::mutex error_mutex;
+    auto keep_error = [&](){
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if(!error) error = std::current_exception();
+    };
+
+    int rel_parallel = parallel_realizations(p);
+
+    //every worker publishes into its own slot, the reporter runs until the end of the run
+    //the telemetry counts every clone as one realization
+    std::unique_ptr<Telemetry> telemetry;
+    if(p.status_path.length()>0 || p.progress){
+        SimParams pt = p;
+        pt.N_rels = output_realizations(p);
+        telemetry.reset(new Telemetry(pt, rel_parallel));
+    }
+    auto status = [&]() -> WorkerStatus* { return telemetry ? &telemetry->worker(worker_id()) : nullptr; };
+    std::vector<Placement::Cpu> cpus = p.pin ? Placement::cpus() : std::vector<Placement::Cpu>();
+
+    if(p.lanes > 1){
+        std::atomic<int> next_rel(0);
+        #if defined(_OPENMP)
+        #pragma omp parallel num_threads(rel_parallel)
+        #endif
+        {
+            WorkerPlacement placement(p, cpus);
+            try{
+                if(p.lanes == 4) run_ensemble<4>(p, sink, next_rel, status());
+                else if(p.lanes == 8) run_ensemble<8>(p, sink, next_rel, status());
+                else run_ensemble<16>(p, sink, next_rel, status());
+            }
+            catch(...){ keep_error(); }
+        }
+    }
+    else{
+        #if defined(_OPENMP)
+        #pragma omp parallel num_threads(rel_parallel)
+        #endif
+        {
+            WorkerPlacement placement(p, cpus);
+            #if defined(_OPENMP)
+            #pragma omp for schedule(dynamic)
+            #endif
+            for(int rel=0; rel < p.N_rels; rel++){
+                try{ run_sim(p, rel, sink, backing_dir, status()); }
+                catch(...){ keep_error(); }
+            }
+        }
+    }
+    if(error){
+        if(telemetry) telemetry->finish("failed");
+        std::rethrow_exception(error);
+    }
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//  SEVERAL s ON THE SAME CHARACTER DRAWS
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+void run_sweep(const SimParams &p, const std::vector<long double> &s_values, const std::vector<SimSink*> &sinks){
+
+    if(s_values.size()!=sinks.size()) throw std::invalid_argument("one sink per s is needed");
+    if(s_values.empty()) return;
+    if(p.lanes!=1) throw std::invalid_argument("lanes cannot be used with several s");
+    if(p.clones>0) throw std::invalid_argument("clones cannot be used with several s");
+    check_params(p);
+    if(p.coupling!="crn" && p.coupling!="independent") throw std::invalid_argument("unknown coupling " + p.coupling);
+    PairDistances::parse(p.distance_precision);
+
+    std::string backing_dir = propensity_storage(p, true);
+    if(backing_dir.length()>0) std::filesystem::create_directories(backing_dir);
+    if(p.matrix_cache.length()>0) std::filesystem::create_directories(p.matrix_cache);
+
+    std::exception_ptr error = nullptr;
+    std::mutex error_mutex;
+    auto keep_error = [&](){
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if(!error) error = std::current_exception();
+    };
+
+    int rel_parallel = parallel_realizations(p);
+
+    //the telemetry counts every (realization, s) as one realization
+    std::unique_ptr<Telemetry> telemetry;
+    if(p.status_path.length()>0 || p.progress){
+        SimParams pt = p;
+        pt.N_rels = p.N_rels * (int) s_values.size();
+        telemetry.reset(new Telemetry(pt, rel_parallel));
+    }
+    auto status = [&]() -> WorkerStatus* { return telemetry ? &telemetry->worker(worker_id()) : nullptr; };
+    std::vector<Placement::Cpu> cpus = p.pin ? Placement::cpus() : std::vector<Placement::Cpu>();
+
+    #if defined(_OPENMP)
+    #pragma omp parallel num_threads(rel_parallel)
+    #endif
+    {
+        WorkerPlacement placement(p, cpus);
+        #if defined(_OPENMP)
+        #pragma omp for schedule(dynamic)
+        #endif
+        for(int rel=0; rel < p.N_rels; rel++){
+            try{ run_sweep_rel(p, s_values, rel, sinks, backing_dir, status()); }
+            catch(...){ keep_error(); }
+        }
+    }
+    if(error){
+        if(telemetry) telemetry->finish("failed");
+        std::rethrow_exception(error);
+    }
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//  THIS IS WHERE THE SIMULATION IS RUNNING
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//  PER THREAD ARENA: the system of the previous realization of the thread is reinitialized
+//  instead of being rebuilt, so a thread stops allocating after its first realization. The
+//  uniform engine (s = 0) has its own slot: a sweep through s = 0 keeps the matrix of the
+//  other s instead of rebuilding it for the next one
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+struct SystemSlot{
+    SimParams key;              //parameters the system was built for (any s)
+    std::string backing_dir;
+    std::unique_ptr<SystemBase> sys;
+};
+struct SystemArena{
+    SystemSlot slots[2];        //uniform engine, any other engine
+    SystemBase *sys = nullptr;  //system of the current realization
+    RandomObject ro;
+    std::vector<double> x;      //characters handed to the sink
+    PairDistances distances;    //distances of the current characters (several s)
+    std::vector<int> cpus;      //cpus of the worker and its team (empty -> not pinned)
+
+    SystemBase &get(const SimParams &p, const std::string &backing_dir_, unsigned long long seed, PairDistances *dist = nullptr){
+        SystemSlot &slot = slots[effective_engine(p)=="uniform" ? 0 : 1];
+        const SimParams &key = slot.key;
+        bool same = slot.sys && key.D==p.D && key.N==p.N && key.INTERNAL==p.INTERNAL
+                    && effective_engine(key)==effective_engine(p) && key.rel_threads==p.rel_threads && key.huge_pages==p.huge_pages
+                    && key.pin==p.pin && key.matrix_cache==p.matrix_cache && key.softmax==p.softmax && key.min_acceptance==p.min_acceptance
+                    && key.compact_below==p.compact_below
+                    && key.arrival_rate==p.arrival_rate && key.departure_rate==p.departure_rate && key.t_max==p.t_max
+                    && slot.backing_dir==backing_dir_;
+        if(same){
+            sys = slot.sys.get();
+            sys->s = p.s;
+            sys->distances = dist;
+            sys->reinitialize(seed);
+            return *sys;
+        }
+        slot.sys.reset();
+        ro.seed(seed);
+        slot.sys = make_system(p, ro, backing_dir_, dist, cpus);
+        slot.key = p;
+        slot.backing_dir = backing_dir_;
+        sys = slot.sys.get();
+        return *sys;
+    }
+    //the shared distances belong to the characters of one realization
+    void forget_distances(){
+        for(SystemSlot &slot : slots) if(slot.sys) slot.sys->distances = nullptr;
+    }
+    void clear(){
+        for(SystemSlot &slot : slots) slot.sys.reset();
+        sys = nullptr;
+        distances.release();
+    }
+    //matrices in scratch files and idle thread teams are not kept around between runs
+    void release(const SimParams &p){
+        if(slots[1].backing_dir.length()>0 || p.rel_threads>1) clear();
+    }
+};
+static thread_local SystemArena arena;
+
+WorkerPlacement::WorkerPlacement(const SimParams &p, const std::vector<Placement::Cpu> &cpus){
+    arena.cpus.clear();
+    if(cpus.empty()) return;
+    arena.cpus = worker_cpus(p, cpus, worker_id());
+    Placement::pin(arena.cpus[0]);
+}
+WorkerPlacement::~WorkerPlacement(){
+    //a system built for these cpus is not reused by an unpinned run
+    if(!arena.cpus.empty()) arena.clear();
+    arena.cpus.clear();
+}
+
+static void run_sim(const SimParams &p, int rel, SimSink &sink, const std::string &backing_dir, WorkerStatus *status){
+
+    //initializing the system
+    if(status){
+        status->publish(rel, p.N, 0, status->steps.load(std::memory_order_relaxed));
+        status->initializing.store(true, std::memory_order_relaxed);
+    }
+    SystemBase &sys = arena.get(p, backing_dir, realization_seed(p, rel));
+    if(status) status->initializing.store(false, std::memory_order_relaxed);
+
+    if(p.clones>0) run_cloned(p, rel, sink, status);
+    else run_realization(sys, rel, sink, status);
+    arena.release(p);
+}
+//-----------------------------------------------------------------------
+// every s is started from the same seed, so it gets the same characters (and with crn
+// the same random numbers for the dynamics); the distances are computed by the first s
+static void run_sweep_rel(const SimParams &p, const std::vector<long double> &s_values, int rel, const std::vector<SimSink*> &sinks,
+                          const std::string &backing_dir, WorkerStatus *status){
+
+    unsigned long long seed = realization_seed(p, rel);
+    PairDistances::Precision precision = PairDistances::parse(p.distance_precision);
+    if(precision != arena.distances.precision) arena.distances.release();
+    arena.distances.precision = precision;
+    arena.distances.place(backing_dir);
+    arena.distances.clear();
+
+    for(size_t k=0; k<s_values.size(); k++){
+        SimParams pk = p;
+        pk.s = s_values[k];
+
+        if(status){
+            status->publish(rel, p.N, 0, status->steps.load(std::memory_order_relaxed));
+            status->initializing.store(true, std::memory_order_relaxed);
+        }
+        SystemBase &sys = arena.get(pk, backing_dir, seed, &arena.distances);
+        //independent dynamics: only the characters are shared
+        if(p.coupling=="independent" && k>0) sys.ro->seed(seed ^ (0x9E3779B97F4A7C15ULL * k));
+        if(status) status->initializing.store(false, std::memory_order_relaxed);
+
+        run_realization(sys, rel, *sinks[k], status);
+    }
+    arena.forget_distances();
+    arena.release(p);
+}
+//-----------------------------------------------------------------------
+static void run_realization(SystemBase &sys, int rel, SimSink &sink, WorkerStatus *status){
+
+    std::vector<double> &x = arena.x;
+    x.resize((size_t) sys.N*sys.D);
+    for(int i=0; i< sys.N; i++){
+        for(int j =0; j<sys.D; j++) x[(size_t) i*sys.D + j] = sys.agent_characters[i][j];
+    }
+    std::unique_ptr<RealizationSink> out = sink.start(rel, sys.N, sys.D, x.data());
+
+    //THIS IS WHERE THE SIMULATION RUNS
+    long long steps0 = status ? status->steps.load(std::memory_order_relaxed) : 0;
+    int counter = 0;
+    run_steps(sys, *out, counter, rel, steps0, status);
+    finish_realization(sys, *out, counter, steps0, status);
+}
+//-----------------------------------------------------------------------
+// Gillespie steps until the realization ends (true) or, with clone_at, until the point
+// of the clones is reached (false); counter counts the steps and goes on from its value
+static bool run_steps(SystemBase &sys, RealizationSink &out, int &counter, int rel, long long steps0, WorkerStatus *status,
+                      const SimParams *clone_at){
+    if(status) status->publish(rel, sys.Nc, sys.t, steps0 + counter);
+    while(sys.gilStep()){
+        counter++;
+        //the labels of the agents (their indices unless agents left)
+        if(sys.last_event==SystemBase::LINK) out.link(sys.agent_label[sys.last_link.first], sys.agent_label[sys.last_link.second], counter, sys.t);
+        else if(sys.last_event==SystemBase::ARRIVAL) out.arrive(sys.agent_label[sys.N-1], counter, sys.t, sys.agent_characters[sys.N-1].data());
+        else for(int label : sys.last_departed) out.depart(label, counter, sys.t);
+        if(status) status->publish(rel, sys.Nc, sys.t, steps0 + counter);
+
+        if(clone_at && ((clone_at->clone_at_nc > 0 && sys.Nc <= clone_at->clone_at_nc)
+                        || (clone_at->clone_at_t > 0 && sys.t >= clone_at->clone_at_t))) return false;
+    }
+    //the step that found nothing to do counts
+    counter++;
+    return true;
+}
+//-----------------------------------------------------------------------
+static void finish_realization(SystemBase &sys, RealizationSink &out, int counter, long long steps0, WorkerStatus *status){
+    out.end(counter, sys.t);
+    if(status){
+        status->publish(-1, sys.Nc, sys.t, steps0 + counter);
+        if(RejectionSystem *rej = dynamic_cast<RejectionSystem*>(&sys)){
+            status->proposals.fetch_add(rej->proposals, std::memory_order_relaxed);
+            status->accepted.fetch_add(rej->accepted, std::memory_order_relaxed);
+            status->switched.fetch_add(rej->switched(), std::memory_order_relaxed);
+        }
+        status->rels_done.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+//-----------------------------------------------------------------------
+// the events of the common prefix of the clones, handed to the sink of every clone
+class PrefixRecorder : public RealizationSink{
+    struct Event{
+        SystemBase::Event kind;
+        int a1, a2;     //link, or the label (a1) of an arrival / departure
+        int step;
+        long double t;
+    };
+    std::vector<Event> events;
+    std::vector<double> characters;     //of the arrivals, in order
+    int D;
+public:
+    PrefixRecorder(int D_): D(D_){}
+    void link(int a1, int a2, int step, long double t) override{
+        events.push_back({SystemBase::LINK, a1, a2, step, t});
+    }
+    void arrive(int label, int step, long double t, const double *character) override{
+        events.push_back({SystemBase::ARRIVAL, label, -1, step, t});
+        characters.insert(characters.end(), character, character + D);
+    }
+    void depart(int label, int step, long double t) override{
+        events.push_back({SystemBase::DEPARTURE, label, -1, step, t});
+    }
+    void replay(RealizationSink &out) const{
+        size_t arrivals = 0;
+        for(const Event &e : events){
+            if(e.kind==SystemBase::LINK) out.link(e.a1, e.a2, e.step, e.t);
+            else if(e.kind==SystemBase::ARRIVAL) out.arrive(e.a1, e.step, e.t, characters.data() + D*arrivals++);
+            else out.depart(e.a1, e.step, e.t);
+        }
+    }
+};
+//-----------------------------------------------------------------------
+// the prefix runs once, then every clone goes on from a copy of the system (the matrix
+// engine shares cp copy on write) with its own random numbers
+static void run_cloned(const SimParams &p, int rel, SimSink &sink, WorkerStatus *status){
+
+    SystemBase &sys = *arena.sys;
+    std::vector<double> &x = arena.x;
+    x.resize((size_t) sys.N*sys.D);
+    for(int i=0; i< sys.N; i++){
+        for(int j =0; j<sys.D; j++) x[(size_t) i*sys.D + j] = sys.agent_characters[i][j];
+    }
+    int N = sys.N;
+
+    PrefixRecorder prefix(sys.D);
+    long long steps0 = status ? status->steps.load(std::memory_order_relaxed) : 0;
+    int counter0 = 0;
+    bool ended = run_steps(sys, prefix, counter0, rel*p.clones, steps0, status, &p);
+
+    unsigned long long seed = realization_seed(p, rel);
+    for(int k=0; k<p.clones; k++){
+        int rel_k = rel*p.clones + k;
+        RandomObject ro;
+        ro.seed(seed ^ (0xBF58476D1CE4E5B9ULL * (k + 1)));
+        std::unique_ptr<SystemBase> c = sys.clone(ro);
+
+        std::unique_ptr<RealizationSink> out = sink.start(rel_k, N, sys.D, x.data());
+        prefix.replay(*out);
+        //the steps of the prefix are counted once
+        long long steps_k = status ? status->steps.load(std::memory_order_relaxed) - counter0 : 0;
+        int counter = counter0;
+        if(!ended) run_steps(*c, *out, counter, rel_k, steps_k, status);
+        finish_realization(*c, *out, counter, steps_k, status);
+    }
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//  L REALIZATIONS IN LOCKSTEP, A LANE THAT FINISHES TAKES THE NEXT REALIZATION
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+template <int L> static void run_ensemble(const SimParams &p, SimSink &sink, std::atomic<int> &next_rel, WorkerStatus *status){
+
+    EnsembleSystem<L> ens(p.D,p.N,p.s,p.INTERNAL);
+    std::vector<std::unique_ptr<RealizationSink>> outs(L);
+
+    auto refill = [&](int lane){
+        int rel = next_rel++;
+        if(rel >= p.N_rels) return;
+        RandomObject ro = RandomObject();
+        ro.seed(realization_seed(p, rel));
+        ens.start(lane, rel, ro);
+        outs[lane] = sink.start(rel, p.N, p.D, ens.lanes[lane].x.data());
+    };
+    for(int lane=0; lane<L; lane++) refill(lane);
+
+    //the status shows the lane with the most clusters left
+    long long steps = 0;
+    while(ens.n_active() > 0){
+        ens.gilStep();
+        int slowest = -1;
+        for(int lane=0; lane<L; lane++){
+            auto &ln = ens.lanes[lane];
+            steps += ln.moved || ln.done;
+            if(ln.moved) outs[lane]->link(ln.last_link.first, ln.last_link.second, ln.step, ln.t);
+            if(ln.done){
+                outs[lane]->end(ln.step, ln.t);
+                outs[lane].reset();
+                if(status) status->rels_done.fetch_add(1, std::memory_order_relaxed);
+                refill(lane);
+            }
+            if(ln.active && (slowest < 0 || ln.Nc > ens.lanes[slowest].Nc)) slowest = lane;
+        }
+        if(status){
+            if(slowest >= 0) status->publish(ens.lanes[slowest].rel, ens.lanes[slowest].Nc, ens.lanes[slowest].t, steps);
+            else status->publish(-1, 0, 0, steps);
+        }
+    }
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+static std::unique_ptr<SystemBase> make_system(const SimParams &p, RandomObject &ro, const std::string &backing_dir, PairDistances *distances,
+                                               const std::vector<int> &cpus){
+    std::string engine = effective_engine(p);
+    MatrixOptions options;
+    options.n_threads = p.rel_threads;
+    options.cpus = cpus;
+    options.huge_pages = p.huge_pages;
+    options.softmax = LogSumExp::parse(p.softmax);
+    options.compact_below = p.compact_below;
+    if(engine=="uniform") return std::unique_ptr<SystemBase>(new UniformSystem(p.D,p.N,p.s,p.INTERNAL,ro));
+    if(engine=="rejection"){
+        //the matrix of a switch is built from the clusters of the moment, it is not cached
+        RejectionSystem *sys = new RejectionSystem(p.D,p.N,p.s,p.INTERNAL,ro,options);
+        sys->min_acceptance = p.min_acceptance;
+        sys->backing_dir = backing_dir;
+        return std::unique_ptr<SystemBase>(sys);
+    }
+    if(engine=="matrix"){
+        options.cache_dir = p.matrix_cache;
+        System *sys = new System(p.D,p.N,p.s,p.INTERNAL,ro,backing_dir,distances,options);
+        sys->open.arrival_rate = p.arrival_rate;
+        sys->open.departure_rate = p.departure_rate;
+        sys->open.t_max = p.t_max;
+        return std::unique_ptr<SystemBase>(sys);
+    }
+    if(engine=="rowsum") return std::unique_ptr<SystemBase>(new RowSumSystem(p.D,p.N,p.s,p.INTERNAL,ro));
+    throw std::invalid_argument("unknown engine " + p.engine);
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+// the parameters are checked before any thread starts
+static void check_params(const SimParams &p){
+    if(p.lanes!=1 && p.lanes!=4 && p.lanes!=8 && p.lanes!=16) throw std::invalid_argument("lanes must be 1, 4, 8 or 16");
+    if(p.engine!="matrix" && p.engine!="rowsum" && p.engine!="uniform" && p.engine!="rejection") throw std::invalid_argument("unknown engine " + p.engine);
+    if(p.min_acceptance<0 || p.min_acceptance>1) throw std::invalid_argument("min acceptance must be in [0, 1]");
+    if(p.compact_below<0 || p.compact_below>1) throw std::invalid_argument("compact below must be in [0, 1]");
+    if(p.engine=="uniform" && p.s!=0) throw std::invalid_argument("the uniform engine needs s = 0");
+    LogSumExp::parse(p.softmax);
+    if(p.arrival_rate<0 || p.departure_rate<0 || p.t_max<0) throw std::invalid_argument("negative rate or t_max");
+    if(p.arrival_rate>0 || p.departure_rate>0){
+        if(effective_engine(p)!="matrix") throw std::invalid_argument("agents can only arrive and leave with the matrix engine");
+        if(p.arrival_rate>0 && p.t_max<=0) throw std::invalid_argument("arrivals need t_max");
+    }
+    if(p.clones<0 || p.clone_at_nc<0 || p.clone_at_t<0) throw std::invalid_argument("negative clones, clone Nc or clone t");
+    if(p.clones>0){
+        if(p.clone_at_nc==0 && p.clone_at_t==0) throw std::invalid_argument("clones need the Nc or the t of the cloning");
+        std::string engine = effective_engine(p);
+        if(engine!="matrix" && engine!="uniform" && engine!="rowsum") throw std::invalid_argument("only the matrix, uniform and rowsum engines can be cloned");
+    }
+}
+//-----------------------------------------------------------------------
+static unsigned long long realization_seed(const SimParams &p, int rel){
+    if(p.seed < 0) return RandomObject::clock_seed() + rel;
+    return (unsigned long long) p.seed + rel;
+}
+//-----------------------------------------------------------------------
+static int worker_id(){
+    #if defined(_OPENMP)
+    return omp_get_thread_num();
+    #else
+    return 0;
+    #endif
+}
+//-----------------------------------------------------------------------
+// consecutive cpus (same node) for the worker and its team
+static std::vector<int> worker_cpus(const SimParams &p, const std::vector<Placement::Cpu> &cpus, int worker){
+    int team = std::max(1, p.rel_threads);
+    std::vector<int> out;
+    for(int m=0; m<team; m++) out.push_back(cpus[((size_t) worker*team + m) % cpus.size()].id);
+    return out;
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+std::string placement_report(const SimParams &p){
+    std::ostringstream out;
+    std::vector<Placement::Cpu> cpus = Placement::cpus();
+    out << cpus.size() << " cpus on " << Placement::n_nodes(cpus) << " NUMA node(s)";
+    if(p.huge_pages) out << ", transparent huge pages for the matrices";
+    out << "\n";
+    if(!p.pin) return out.str() + "threads not pinned\n";
+    int workers = parallel_realizations(p);
+    for(int w=0; w<workers; w++){
+        out << "worker " << w << ": cpu";
+        for(int c : worker_cpus(p, cpus, w)) out << " " << c;
+        out << " (node " << cpus[((size_t) w*std::max(1, p.rel_threads)) % cpus.size()].node << ")";
+        out << "\n";
+    }
+    if((size_t) workers*std::max(1, p.rel_threads) > cpus.size()) out << "more threads than cpus, some share a cpu\n";
+    return out.str();
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+std::string effective_engine(const SimParams &p){
+    if(p.lanes > 1) return "ensemble";
+    //a constant kernel needs no matrix (unless agents come and go)
+    if(p.engine=="matrix" && p.s==0 && p.arrival_rate==0 && p.departure_rate==0) return "uniform";
+    return p.engine;
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+int output_realizations(const SimParams &p){
+    return (p.clones > 0) ? p.N_rels*p.clones : p.N_rels;
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+int parallel_realizations(const SimParams &p){
+    int n_threads = 1;
+    #if defined(_OPENMP)
+    n_threads = (p.n_threads > 0) ? p.n_threads : omp_get_max_threads();
+    #endif
+    return std::max(1, n_threads/std::max(1, p.rel_threads));
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+std::string propensity_storage(const SimParams &p, bool sweep){
+    //every thread holds one matrix at a time (the rejection engine once its acceptance collapses),
+    //and in a sweep of the matrix engine the distances of its characters (the positional s of a
+    //sweep is not run)
+    std::string engine = sweep ? p.engine : effective_engine(p);
+    if((engine!="matrix" && engine!="rejection") || p.lanes > 1 || p.mem_budget <= 0) return "";
+    long double per_thread = LowerTriangle<long double>::bytes_needed(p.N);
+    if(sweep && engine=="matrix") per_thread += PairDistances::bytes_needed(p.N, PairDistances::parse(p.distance_precision));
+    long double needed = per_thread * parallel_realizations(p);
+    if(needed <= p.mem_budget*1.0e9) return "";
+    if(p.mmap_dir.length()>0) return p.mmap_dir;
+    return std::filesystem::temp_directory_path().string();
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//  SINKS
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+class CsvRealization : public RealizationSink{
+    std::ofstream edge_file;
+    std::pair<int, int> last_link;
+    std::string str_events;     //arrivals and departures, only created by the first one
+    std::ofstream event_file;
+    int D;
+
+    void open_events(){
+        if(event_file.is_open()) return;
+        event_file.open(str_events);
+        if (!event_file.is_open()) throw std::invalid_argument("error opening event file");
+        event_file << "Event,NodeLabel,Step,Time";
+        for(int i=0; i<D; i++) event_file << ",x" << i;
+        event_file << std::endl;
+    }
+public:
+    CsvRealization(const std::string &str_edges, const std::string &str_events_, int D_): str_events(str_events_), D(D_){
+        edge_file.open(str_edges);
+        if (!edge_file.is_open()) throw std::invalid_argument("error opening edge file");
+        edge_file << "Node1,Node2,Step,Time" << std::endl;
+    }
+    void link(int a1, int a2, int step, long double t) override{
+        last_link = {a1, a2};
+        edge_file << a1 << "," << a2 << "," << step << "," << t << std::endl;
+    }
+    void arrive(int label, int step, long double t, const double *character) override{
+        open_events();
+        event_file << "arrival," << label << "," << step << "," << t;
+        for(int j=0; j<D; j++) event_file << "," << character[j];
+        event_file << std::endl;
+    }
+    void depart(int label, int step, long double t) override{
+        open_events();
+        event_file << "departure," << label << "," << step << "," << t << std::string(D, ',') << std::endl;
+    }
+    void end(int steps, long double t) override{
+        //the last link is repeated with the final step count
+        edge_file << last_link.first << "," << last_link.second << "," << steps << "," << t << std::endl;
+        edge_file.close();
+    }
+};
+
+CsvSink::CsvSink(const std::string &folder_, const std::string &prefix_): folder(folder_), prefix(prefix_){}
+
+std::unique_ptr<RealizationSink> CsvSink::start(int rel, int N, int D, const double *characters){
+    //okay first lets decide whats the data we are gonna write
+    std::string str_nodes = folder+"/"+prefix+"-"+std::to_string(rel)+".node.csv";
+    std::string str_edges = folder+"/"+prefix+"-"+std::to_string(rel)+".edge.csv";
+    std::string str_events = folder+"/"+prefix+"-"+std::to_string(rel)+".event.csv";
+
+    std::ofstream node_file(str_nodes);
+    if (!node_file.is_open()) throw std::invalid_argument("error opening node file");
+    node_file << "NodeLabel";
+    for(int i=0; i<D; i++) node_file << ",x" << i;
+    node_file << std::endl;
+    for(int i=0; i< N; i++){
+        node_file << i;
+        for(int j =0; j<D; j++) node_file << "," << characters[(size_t) i*D + j];
+        node_file << std::endl;
+    }
+    node_file.close();
+
+    return std::unique_ptr<RealizationSink>(new CsvRealization(str_edges, str_events, D));
+}
+//-----------------------------------------------------------------------
+class MemoryRealization : public RealizationSink{
+    SimResult &res;
+public:
+    MemoryRealization(SimResult &res_): res(res_){}
+    void link(int a1, int a2, int /*step*/, long double t) override{
+        res.a1.push_back(a1);
+        res.a2.push_back(a2);
+        res.t.push_back(t);
+    }
+    void end(int steps, long double t) override{
+        res.steps = steps;
+        res.t_end = t;
+    }
+};
+
+MemorySink::MemorySink(int N_rels): results(N_rels){}
+
+std::unique_ptr<RealizationSink> MemorySink::start(int rel, int N, int D, const double *characters){
+    //every realization has its own slot, no locking needed
+    SimResult &res = results.at(rel);
+    res = SimResult();
+    res.characters.assign(characters, characters + (size_t) N*D);
+    return std::unique_ptr<RealizationSink>(new MemoryRealization(res));
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//  BATCHES
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+BatchRunner::BatchRunner(int n_workers): stop(false){
+    for(int i=0; i<std::max(1, n_workers); i++) workers.emplace_back(&BatchRunner::work, this);
+}
+
+BatchRunner::~BatchRunner(){
+    {
+        std::lock_guard<std::mutex> lock(m);
+        stop = true;
+    }
+    cv.notify_all();
+    for(auto &w : workers) w.join();
+}
+
+std::future<void> BatchRunner::submit(const SimParams &params, std::shared_ptr<SimSink> sink){
+    std::packaged_task<void()> task([params, sink](){ run_simulation(params, *sink); });
+    std::future<void> result = task.get_future();
+    {
+        std::lock_guard<std::mutex> lock(m);
+        queue.push_back(std::move(task));
+    }
+    cv.notify_one();
+    return result;
+}
+
+void BatchRunner::work(){
+    while(true){
+        std::packaged_task<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m);
+            cv.wait(lock, [this](){ return stop || !queue.empty(); });
+            if(queue.empty()) return;
+            task = std::move(queue.front());
+            queue.pop_front();
+        }
+        task();
+    }
+}
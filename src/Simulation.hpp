@@ -0,0 +1,168 @@
+/*
+  Description: In process interface of the simulator (library TPsim).
+
+  run_simulation() runs all the realizations of one parameter set and hands the
+  results to a sink. It keeps no global state, so several parameter sets can run
+  at the same time in one process (see BatchRunner, and tp_api.h for C).
+
+  The sinks are called from the threads that run the realizations: start() can be
+  called concurrently for different realizations, the RealizationSink it returns is
+  only used by one thread at a time.
+*/
+
+#ifndef simulation_h
+#define simulation_h
+
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+
+//-----------------------------------------------------------------------
+// Parameters of a run
+//-----------------------------------------------------------------------
+struct SimParams{
+  int N_rels = 1;               //number of realizations
+  int D = 1;                    //dimension of the characters
+  int N = 10;                   //number of agents
+  long double s = 0;            //selectivity
+  bool INTERNAL = false;        //links inside clusters
+  long long seed = -1;          //realization rel uses seed + rel, -1 -> seeds from the clock
+
+  std::string engine = "matrix";  //matrix (System, UniformSystem when s = 0), rowsum (RowSumSystem), uniform, rejection
+  int rel_threads = 1;          //threads inside one realization (matrix engine)
+  int lanes = 1;                //4, 8, 16: realizations in lockstep per thread (EnsembleSystem)
+  int n_threads = 0;            //threads of the run, 0 -> OpenMP default
+  long double mem_budget = 0;   //GB for the propensity matrices, 0 -> no limit
+  std::string mmap_dir = "";    //scratch directory when over budget (default: temp directory)
+  bool pin = false;             //pins the threads to cpus, grouped by NUMA node (Linux)
+  bool huge_pages = false;      //transparent huge pages for the propensity matrices (Linux)
+  std::string matrix_cache = ""; //directory of the cached initialized matrices (matrix engine), empty -> none
+  std::string softmax = "fast";  //exp of the matrix normalization: fast (vectorized double), long (long double)
+  double min_acceptance = 0.01;  //rejection engine: below this acceptance a realization goes on with a matrix
+  double compact_below = 0.05;   //matrix without internal links: the matrix keeps only the live pairs once
+                                 //they are fewer than this fraction of it, 0 -> never
+
+  //open system (matrix engine): agents arrive and clusters leave, both zero -> closed
+  long double arrival_rate = 0;   //new agents per unit time
+  long double departure_rate = 0; //departures per cluster and unit time
+  long double t_max = 0;          //end of the open realizations, needed with arrivals
+
+  //cloning: every realization runs until Nc <= clone_at_nc or t >= clone_at_t, then goes on as
+  //clones continuations with their own random numbers (clone k of realization rel is realization
+  //rel*clones + k of the sink, with the links of the common prefix)
+  int clones = 0;                 //0 -> no cloning
+  int clone_at_nc = 0;
+  long double clone_at_t = 0;
+
+  std::string status_path = ""; //status file (JSON) replaced every status_interval, empty -> none
+  double status_interval = 10;  //seconds between two reports
+  bool progress = false;        //one line per report on stderr
+
+  //runs of several s (run_sweep)
+  std::string coupling = "crn"; //crn: same random numbers for the dynamics of every s, independent
+  std::string distance_precision = "double";  //storage of the shared distances: long, double, float, u16
+};
+
+//-----------------------------------------------------------------------
+// Result sinks
+//-----------------------------------------------------------------------
+class RealizationSink{
+public:
+  virtual ~RealizationSink(){}
+  //one call per link, step counts from 1
+  virtual void link(int a1, int a2, int step, long double t) = 0;
+  //open systems: an agent arrives (label N, N+1, ...) or leaves with its cluster
+  virtual void arrive(int /*label*/, int /*step*/, long double /*t*/, const double */*character*/){}
+  virtual void depart(int /*label*/, int /*step*/, long double /*t*/){}
+  //steps is the number of Gillespie steps tried (links + 1)
+  virtual void end(int /*steps*/, long double /*t*/){}
+};
+
+class SimSink{
+public:
+  virtual ~SimSink(){}
+  //characters are N x D, agent major
+  virtual std::unique_ptr<RealizationSink> start(int rel, int N, int D, const double *characters) = 0;
+};
+
+// Writes the node and edge csv files of every realization (the files of TP.out)
+class CsvSink : public SimSink{
+  std::string folder;
+  std::string prefix;
+public:
+  CsvSink(const std::string &folder_, const std::string &prefix_);
+  std::unique_ptr<RealizationSink> start(int rel, int N, int D, const double *characters) override;
+};
+
+// Keeps every realization in memory
+struct SimResult{
+  std::vector<double> characters;   //N x D
+  std::vector<int> a1;              //linked agents, one entry per link
+  std::vector<int> a2;
+  std::vector<long double> t;       //time of every link
+  int steps = 0;
+  long double t_end = 0;
+};
+
+class MemorySink : public SimSink{
+public:
+  std::vector<SimResult> results;   //indexed by realization
+
+  MemorySink(int N_rels);
+  std::unique_ptr<RealizationSink> start(int rel, int N, int D, const double *characters) override;
+};
+
+//-----------------------------------------------------------------------
+// Running
+//-----------------------------------------------------------------------
+void run_simulation(const SimParams &params, SimSink &sink);
+
+// Runs every s of s_values on the same character draws (params.s is not used): the pairwise
+// distances of a draw are computed once and every s derives its propensities from them.
+// sinks[k] receives the realizations of s_values[k].
+void run_sweep(const SimParams &params, const std::vector<long double> &s_values, const std::vector<SimSink*> &sinks);
+
+//directory of the scratch files of the propensity matrices (and of the distances shared by the
+//s of a sweep), empty if they fit the budget
+std::string propensity_storage(const SimParams &params, bool sweep = false);
+//engine that runs the realizations (matrix, rowsum, uniform, rejection or ensemble)
+std::string effective_engine(const SimParams &params);
+//realizations running at the same time
+int parallel_realizations(const SimParams &params);
+//realizations handed to the sinks (N_rels times the clones)
+int output_realizations(const SimParams &params);
+//cpus and NUMA nodes used by the workers (one line per worker when pinning)
+std::string placement_report(const SimParams &params);
+
+// Runs submitted parameter sets on a fixed number of worker threads.
+// submit() can be called from any thread, the future rethrows the errors of the run.
+class BatchRunner{
+  std::vector<std::thread> workers;
+  std::deque<std::packaged_task<void()>> queue;
+  std::mutex m;
+  std::condition_variable cv;
+  bool stop;
+
+public:
+  BatchRunner(int n_workers);
+  ~BatchRunner(); //finishes the jobs already submitted
+  BatchRunner(const BatchRunner &) = delete;
+  BatchRunner& operator=(const BatchRunner &) = delete;
+
+  std::future<void> submit(const SimParams &params, std::shared_ptr<SimSink> sink);
+
+private:
+  void work();
+};
+
+
+
+
+#endif //simulation_h
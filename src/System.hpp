@@ -7,83 +7,215 @@
 #ifndef system_h
 #define system_h
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <iostream>
+#include <memory>
 #include <vector>
 
 
 
 #include "include/LowerTriangle.hpp"
+#include "include/ThreadTeam.hpp"
 #include "include/RandomObject.hpp"
 #include "include/utils.hpp"
+#include "SystemBase.hpp"
 #include "CPI.hpp" //This is the library that calculated the initial agg matrix
+#include "MatrixCache.hpp"
 
 
 
-class System{
-public:
-  //hyper paramaters (input):
-  int D;
-  int N;
-  long double s;
-  bool INTERNAL;
-
-  //RANDOM OBJECT
-  RandomObject *ro;
-
-  //System Paramaters
-  long double t; //time
-  int Nc;//Number of clusters its good to know
+//placement and cache of the propensity matrix of a system
+struct MatrixOptions{
+  int n_threads = 1;          //threads working on the realization
+  std::vector<int> cpus;      //cpu of every thread, empty -> not pinned
+  bool huge_pages = false;    //transparent huge pages for cp
+  std::string cache_dir;      //initialized matrices are loaded from / stored in it, empty -> no cache
+  LogSumExp::Kernel softmax = LogSumExp::FAST;  //exp of the normalization of cp (the default of TP.out)
+  double compact_below = 0;   //cp keeps only the live pairs once they fall below this fraction of it (0 -> never)
+};
 
-  //System State
-  //agents
-  std::vector<std::vector<double>> agent_characters;
-  //cluster trackets
-  std::vector<std::vector<int>> cs;
-  std::vector<int> agent_location;
+//agents arriving and clusters leaving during a realization (all zero -> closed system)
+struct OpenSystem{
+  long double arrival_rate = 0;    //new agents per unit time
+  long double departure_rate = 0;  //departures per cluster and unit time
+  long double t_max = 0;           //end of the realization, 0 -> none
+  bool enabled() const {return arrival_rate > 0 || departure_rate > 0;}
+};
 
-  //Save Last interaction:
-  std::pair<int, int> last_link;
+//propensities of a realization written once to a file (in memory, or a scratch file of the
+//backing directory out of core); the clones of the realization map it copy on write, so
+//each one only copies the pages it changes
+struct CpSnapshot{
+  MappedArray<long double> arr;
+  MappedArray<long double> block_sum;
+  MappedArray<long long> live;  //a compacted cp
+  bool is_compact;
+  int dim;
+  long long size;
+  long double cumulative;
+
+  CpSnapshot(const LowerTriangle<long double> &cp, const std::string &backing_dir){
+    arr = backing_dir.empty() ? MappedArray<long double>::memory_file(cp.size) : MappedArray<long double>(cp.size, backing_dir);
+    block_sum = backing_dir.empty() ? MappedArray<long double>::memory_file(cp.block_sum.size())
+                                    : MappedArray<long double>(cp.block_sum.size(), backing_dir);
+    if (cp.size > 0) std::memcpy(arr.data(), cp.arr.data(), cp.size*sizeof(long double));
+    if (cp.block_sum.size() > 0) std::memcpy(block_sum.data(), cp.block_sum.data(), cp.block_sum.size()*sizeof(long double));
+    is_compact = cp.compacted();
+    if (is_compact) {
+      live = backing_dir.empty() ? MappedArray<long long>::memory_file(cp.size) : MappedArray<long long>(cp.size, backing_dir);
+      if (cp.size > 0) std::memcpy(live.data(), cp.live.data(), cp.size*sizeof(long long));
+    }
+    dim = cp.dim;
+    size = cp.size;
+    cumulative = cp.cumulative;
+  }
+  //cp becomes a private mapping of the snapshot (with the same partitions)
+  void map(LowerTriangle<long double> &cp) const{
+    int n_parts = cp.part_sum.size();
+    cp.arr = MappedArray<long double>::map_private(arr.file(), 0, size);
+    cp.block_sum = MappedArray<long double>::map_private(block_sum.file(), 0, block_sum.size());
+    //the indices of a compacted cp are only read
+    cp.live = is_compact ? MappedArray<long long>::map_private(live.file(), 0, size) : MappedArray<long long>();
+    cp.is_compact = is_compact;
+    cp.dim = dim;
+    cp.size = size;
+    cp.cumulative = cumulative;
+    if (n_parts > 0) cp.partition(n_parts);
+  }
+};
 
+class System : public SystemBase{
+public:
   //Aggregation stuff
-  long double R;
   LowerTriangle<long double> cp;
-  long double normalization_factor;
+  std::string backing_dir; //empty -> cp in memory, else scratch files in this directory
+  std::unique_ptr<ThreadTeam> team; //threads sharing the work of this realization (null -> serial)
+  MatrixCache cache;
+  LogSumExp::Kernel softmax;
+  OpenSystem open;
+  //the stored propensities keep the scale of the first normalization: p_ij = exp(a_ij - log_scale),
+  //scaled_sum is the sum of all of them (diagonal included), so the normalization factor
+  //follows arrivals and departures without touching the rest of cp
+  long double log_scale;
+  long double scaled_sum;
+  //shared by the clones of the realization (null until the first clone)
+  std::shared_ptr<CpSnapshot> snapshot;
+  //without INTERNAL links only the pairs of different clusters are live; once they are fewer
+  //than compact_below times the elements of cp, cp is compacted (closed systems)
+  double compact_below = 0;
+  long long live_pairs;
 
 public:
-  System(int D_, int N_, long double s_,bool INTERNAL_,RandomObject &ro_);
+  System(int D_, int N_, long double s_,bool INTERNAL_,RandomObject &ro_, const std::string &backing_dir_ = "", PairDistances *distances_ = nullptr,
+         const MatrixOptions &options = MatrixOptions());
+  //matrix of a realization already running (a matrix free engine handing over): the agents and
+  //clusters of state; without INTERNAL links the pairs inside a cluster are zeroed, with them
+  //the caller zeroes the linked pairs
+  System(const SystemBase &state, const std::string &backing_dir_ = "", const MatrixOptions &options = MatrixOptions());
 
   void aggregate(int a1, int a2);
-  bool gilStep();
+  bool gilStep() override;
+  //open systems: a new agent, the departure of cluster c (O(N D) per agent)
+  void arrive();
+  void depart(int c);
+  void reinitialize(unsigned long long seed) override;
+  //the first clone writes the snapshot of cp and maps it in this system as well (its own
+  //pages are given back), every clone maps it copy on write
+  std::unique_ptr<SystemBase> clone(RandomObject &ro_) override;
+
+  //splits the selection and the zeroing of cp between n_threads threads
+  void use_threads(int n_threads);
 
 
-  void printHP();
-  void printNC();
-  void printCP();
+  void printCP() override;
+
+  //links the pair where the cumulative sum of cp reaches val
+  void link(long double val);
 
 
 private:
-  void initNC();
+  System(const System &parent, RandomObject &ro_);
+  void placeCP(const MatrixOptions &options);
   void initCP();
+  bool gilStepOpen();
+  //propensity of a pair on the scale of cp
+  long double weight(int a1, int a2);
+  void count_live_pairs();
 
 
 };
 //-----------------------------------------------------------------------
-inline System::System(int D_, int N_, long double s_,bool INTERNAL_,RandomObject &ro_)
-  :D(D_),N(N_),s(s_),INTERNAL(INTERNAL_),cp(0),ro(&ro_){
-
-    //initialization
-    t =0;
-    Nc = N;
-    R =  2.0 / (1.0 * (N * (N)));
-
+inline System::System(int D_, int N_, long double s_,bool INTERNAL_,RandomObject &ro_, const std::string &backing_dir_, PairDistances *distances_,
+                      const MatrixOptions &options)
+  :SystemBase(D_,N_,s_,INTERNAL_,ro_),cp(0),backing_dir(backing_dir_),cache(options.cache_dir),softmax(options.softmax),
+   compact_below(options.compact_below){
 
-    //initialize the nodes and clusters
-    initNC();
+    distances = distances_;
+    placeCP(options);
 
     //initialize the agg matrix
     initCP();   
 }
 //-----------------------------------------------------------------------
+inline System::System(const SystemBase &state, const std::string &backing_dir_, const MatrixOptions &options)
+  :SystemBase(state),cp(0),backing_dir(backing_dir_),softmax(options.softmax),compact_below(options.compact_below){
+
+    //the distances and the cache belong to the characters of a new realization
+    distances = nullptr;
+    placeCP(options);
+    initCP();
+
+    //with INTERNAL links the unlinked pairs of a cluster can still link
+    if (INTERNAL == false) {
+      for (int c = 0; c < N; c++) {
+        if (cluster_size[c] < 2) continue;
+        members(c, members1);
+        for (size_t k = 1; k < members1.size(); k++) {
+          for (size_t l = 0; l < k; l++) cp.set(members1[k], members1[l], 0);
+        }
+      }
+    }
+    count_live_pairs();
+}
+//-----------------------------------------------------------------------
+inline System::System(const System &parent, RandomObject &ro_)
+  :SystemBase(parent),cp(0),backing_dir(parent.backing_dir),softmax(parent.softmax),open(parent.open),
+   log_scale(parent.log_scale),scaled_sum(parent.scaled_sum),snapshot(parent.snapshot),compact_below(parent.compact_below),
+   live_pairs(parent.live_pairs){
+
+    ro = &ro_;
+    distances = nullptr;
+    snapshot->map(cp);
+    if (parent.team) {
+      team.reset(new ThreadTeam(parent.team->size()));
+      cp.partition(parent.team->size());
+    }
+}
+//-----------------------------------------------------------------------
+inline std::unique_ptr<SystemBase> System::clone(RandomObject &ro_){
+  if (!snapshot) {
+    snapshot = std::make_shared<CpSnapshot>(cp, backing_dir);
+    snapshot->map(cp);
+  }
+  return std::unique_ptr<SystemBase>(new System(*this, ro_));
+}
+//-----------------------------------------------------------------------
+inline void System::placeCP(const MatrixOptions &options){
+    //the pages of cp are placed before the matrix is first written: with pinned
+    //threads every one of them first-touches its own partition
+    if (options.huge_pages || options.n_threads > 1) {
+      cp = LowerTriangle<long double>(N, backing_dir);
+      if (options.huge_pages) cp.arr.advise_huge_pages();
+      if (options.n_threads > 1) {
+        team.reset(new ThreadTeam(options.n_threads, options.cpus));
+        cp.partition(options.n_threads);
+        if (!options.cpus.empty()) cp.place(*team);
+      }
+    }
+}
+//-----------------------------------------------------------------------
 // Aggregate Method Implementation
 inline void System::aggregate(int a1, int a2) {
     // Getting the respective clusters
@@ -105,29 +237,27 @@ inline void System::aggregate(int a1, int a2) {
         last_link.first=a1;
         last_link.second =a2;
 
-        Nc--;
         // Update the aggregation matrix
         if (INTERNAL == true) {
             cp.set(a1, a2, 0);
         } else {
             // Remove internal links
-            for (int i : cs[c1]) {
-                for (int j : cs[c2]) {
-                    cp.set(i, j, 0);
-                }
-            }
+            members(c1, members1);
+            members(c2, members2);
+            if (team) cp.zero_pairs(members1, members2, *team);
+            else cp.zero_pairs(members1, members2);
+            live_pairs -= (long long) members1.size() * members2.size();
+            if (compact_below > 0 && !open.enabled() && live_pairs > 0 && live_pairs < compact_below * cp.size) cp.compact();
         }
         // Update clusters
-        for (int j : cs[c2]) {
-            cs[c1].push_back(j);
-            agent_location[j] = c1;
-        }
-        cs[c2].clear();
+        merge_clusters(c1, c2);
     }
 }
 //-----------------------------------------------------------------------
 inline bool System::gilStep() {
 
+  if (open.enabled()) return gilStepOpen();
+
   long double r1 = (long double)(ro->get_double());
   long double  r2 = (long double)(ro->get_double());
   // std::cout << r1 << " " <<r2 <<std::endl; //TODO
@@ -142,9 +272,9 @@ inline bool System::gilStep() {
   // std::cout << alpha << " " << normalization_factor << " " <<std::endl; //TODO
 
 
-  //Calculation of Time step //FIX not sure of including the normalization factor here
+  //Calculation of Time step
   
-  long double dt = (1.0 / (1.0 * R * normalization_factor)) * std::log(1.0 / (1.0 *r1));
+  long double dt = time_step(r1);
   t += dt;
   // std::cout << R << " " <<dt <<std::endl; //TODO
 
@@ -155,15 +285,7 @@ inline bool System::gilStep() {
   // std::cout << alpha << " " << val << " " <<std::endl; //TODO
 
   if (val <= alpha){
-    int index = cp.search_exceeds_cum(val);
-    int row = cp.get_row(index), col = cp.get_col(index);
-    if (row >= N || col >= N || row == col) {
-        std::cout << alpha<< " " << cp.get_cum() << std::endl;
-        std::cout << N<< " " << row << " " << col << std::endl;
-        throw std::invalid_argument("Out of bounds aggregation");
-    }
-    // std::cout << "Aggregating " <<  row  <<"  and " << col << " " <<std::endl; //TODO
-    aggregate(row, col);
+    link(val);
     return true;
   }
 
@@ -172,74 +294,153 @@ inline bool System::gilStep() {
   throw std::invalid_argument("Shouldn't be here");
   return false;
 }
-
 //-----------------------------------------------------------------------
-inline void System::initNC(){
-    agent_characters.resize(N);
-    cs.resize(N);
-    agent_location.resize(N);
-
-    //initializing as monomer only with characters in unifrom distribution
-    for(int i=0; i<N; i++){
-        std::vector<double>  temp_char;
-        temp_char.reserve(D); // Reserve space for D elements
-
-        for (int j = 0; j < D; j++) {
-            temp_char.push_back(ro->get_double());
-        }
-        agent_characters[i] = temp_char;
-
-        cs[i].push_back(i);
-        agent_location[i] = i;
+inline void System::link(long double val) {
+    long long index = team ? cp.search_exceeds_cum(val, *team) : cp.search_exceeds_cum(val);
+    int row = cp.get_row(index), col = cp.get_col(index);
+    if (row >= N || col >= N || row == col) {
+        std::cout << cp.get_cum() << std::endl;
+        std::cout << N<< " " << row << " " << col << std::endl;
+        throw std::invalid_argument("Out of bounds aggregation");
     }
+    // std::cout << "Aggregating " <<  row  <<"  and " << col << " " <<std::endl; //TODO
+    last_event = LINK;
+    aggregate(row, col);
 }
+//-----------------------------------------------------------------------
+// Gillespie step over merges (rate R * normalization_factor while Nc > 1), arrivals and
+// departures; false when nothing can happen anymore or at t_max
+inline bool System::gilStepOpen() {
 
-inline void System::initCP(){
+  long double r1 = (long double)(ro->get_double());
+  long double r2 = (long double)(ro->get_double());
 
+  long double merge_rate = (Nc > 1) ? R * normalization_factor : 0;
+  long double departure_rate = open.departure_rate * Nc;
+  long double total = merge_rate + open.arrival_rate + departure_rate;
+  if (!(total > 0)) return false;
 
+  long double dt = std::log(1.0 / r1) / total;
+  if (open.t_max > 0 && t + dt > open.t_max) return false;
+  t += dt;
+
+  long double u = r2 * total;
+  if (u < merge_rate) {
+    link((u / merge_rate) * cp.get_cum());
+  }
+  else if (u < merge_rate + open.arrival_rate) {
+    arrive();
+  }
+  else {
+    //the k-th cluster leaves
+    int k = std::min(Nc - 1, (int) ((u - merge_rate - open.arrival_rate) / open.departure_rate));
+    int c = 0;
+    for (; c < N; c++) {
+      if (cluster_size[c] > 0 && k-- == 0) break;
+    }
+    depart(c);
+  }
+  return true;
+}
+//-----------------------------------------------------------------------
+inline long double System::weight(int a1, int a2) {
+  return std::exp(CPI::softMaxArg(CPI::manh_distance(agent_characters[a1], agent_characters[a2]), s) - log_scale);
+}
+//-----------------------------------------------------------------------
+inline void System::arrive() {
+  int a = add_agent();
+  cp.add();
+  //the new row (its agent is alone, every pair can link), the diagonal only counts in the sum
+  long double row_sum = std::exp(-log_scale);
+  for (int j = 0; j < a; j++) {
+    long double w = weight(a, j);
+    cp.set(a, j, w);
+    row_sum += w;
+  }
+  scaled_sum += row_sum;
+  normalization_factor = log_scale + std::log(scaled_sum);
+  last_event = ARRIVAL;
+}
+//-----------------------------------------------------------------------
+inline void System::depart(int c) {
+  members(c, members2);
+  std::sort(members2.begin(), members2.end());
+
+  //every pair with a leaving agent leaves the sum once
+  std::vector<char> gone(N, 0);
+  for (int a : members2) gone[a] = 1;
+  long double removed = 0;
+  for (int a : members2) {
+    for (int j = 0; j < N; j++) {
+      if (!(gone[j] && j < a)) removed += (j == a) ? std::exp(-log_scale) : weight(a, j);
+    }
+  }
 
-  CPI cp_temp = CPI(agent_characters, s);
+  //same moves as remove_cluster: the last row takes the place of every leaving agent
+  for (int k = (int) members2.size() - 1; k >= 0; k--) cp.remove(members2[k]);
+  remove_cluster(c);
 
-  cp.reset(cp_temp.lt); //deep copy
-  normalization_factor = cp_temp.normalization_factor; //not sure how i will use it yet
+  scaled_sum = (N > 0) ? scaled_sum - removed : 0;
+  normalization_factor = (N > 0) ? log_scale + std::log(scaled_sum) : 0;
+  last_event = DEPARTURE;
+}
 
+//-----------------------------------------------------------------------
+inline void System::reinitialize(unsigned long long seed){
+  snapshot.reset();
+  SystemBase::reinitialize(seed);
+  initCP();
+}
+//-----------------------------------------------------------------------
+inline void System::use_threads(int n_threads){
+  if (n_threads <= 1) {
+    team.reset();
+    return;
+  }
+  team.reset(new ThreadTeam(n_threads));
+  cp.partition(n_threads);
 }
+//-----------------------------------------------------------------------
+inline void System::initCP(){
+
 
 
+  //the mapping of a previous load is not written and an open system may have resized or a
+  //previous realization compacted cp: new storage, with the same partitions
+  if (cp.arr.is_cow() || cp.dim != N || cp.compacted()) {
+    int n_parts = cp.part_sum.size();
+    cp = LowerTriangle<long double>(N, backing_dir);
+    if (n_parts > 0) cp.partition(n_parts);
+  }
+
+  //a cached matrix is mapped copy on write (copied into the scratch file out of core)
+  std::string kernel = "manhattan-softmax/" + (distances != nullptr ? distances->name() : std::string("long"))
+                       + "/" + LogSumExp::name(softmax);
+  if (!cache.enabled() || !cache.load(agent_characters, s, kernel, cp, normalization_factor)) {
+    //the storage of cp is handed to CPI and back, so a reinitialization does not allocate
+    //(shared distances are computed by the first system of the characters)
+    if (distances != nullptr && !distances->ready) distances->compute(agent_characters);
+    CPI cp_temp = (distances != nullptr) ? CPI(*distances, s, std::move(cp), backing_dir, softmax)
+                                         : CPI(agent_characters, s, std::move(cp), backing_dir, softmax);
+
+    cp = std::move(cp_temp.lt); //no copy, the matrix can be bigger than memory
+    normalization_factor = cp_temp.normalization_factor; //not sure how i will use it yet
+    if (cache.enabled()) cache.store(agent_characters, s, kernel, cp, normalization_factor);
+  }
+  log_scale = normalization_factor;
+  scaled_sum = 1;
+  count_live_pairs();
+}
 //-----------------------------------------------------------------------
-inline void System::printHP() {
-    std::cout << "\nHyperparameters:" << std::endl;
-    std::cout << "D: " << D << std::endl;
-    std::cout << "N: " << N << std::endl;
-    std::cout << "s: " << s << std::endl;
-    std::cout << "INTERNAL: " << (INTERNAL ? "true" : "false") << std::endl;
+inline void System::count_live_pairs(){
+  //pairs of different clusters: (N^2 - sum of the squared sizes) / 2
+  long long same = 0;
+  for (int c = 0; c < N; c++) same += (long long) cluster_size[c] * cluster_size[c];
+  live_pairs = ((long long) N * N - same) / 2;
 }
-inline void System::printNC(){
-    std::cout << "\nAGENTS: " << std::endl;
-    int i=0;
-    for( auto vi: agent_characters){
-        std::cout << "\tAgent "<< i << ":\t " << "Character:  " ;
-        for( auto vii : vi){
-            std::cout << vii << " ";
-        }
 
-        std::cout << "\tLocation:  " << agent_location[i];
-        std::cout << std::endl;
-        i++;
-    }
-    std::cout << "\nCLUSTERS\n";
-    for (int i = 0; i < cs.size(); ++i) {
-        if(cs[i].size()>0){
-            std::cout << "Cluster " << i << "\t";
-            std::cout << "Members: ";
-            for (int j : cs[i]) {
-                std::cout << j << " ";
-            }
-            std::cout << "\n";
-        }
-       
-    }
-} 
+
+//-----------------------------------------------------------------------
 inline void System::printCP(){
   std::cout << "\nCoalesence Probability: " << std::endl;
   cp.print_lower_triangle();
@@ -259,4 +460,4 @@ inline void System::printCP(){
 
 
 
-#endif //system_h
\ No newline at end of file
+#endif //system_h
@@ -0,0 +1,292 @@
+/*
+  Description: State shared by all the simulation engines (agents, clusters, clock).
+  The engines differ only in how they store the propensities and select the next link.
+*/
+
+#ifndef system_base_h
+#define system_base_h
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "include/RandomObject.hpp"
+#include "include/utils.hpp"
+#include "PairDistances.hpp"
+
+
+
+class SystemBase{
+public:
+  //hyper paramaters (input):
+  int D;
+  int N;      //agents present (changes in an open system)
+  int N0;     //agents at the start of a realization
+  long double s;
+  bool INTERNAL;
+
+  //RANDOM OBJECT
+  RandomObject *ro;
+
+  //System Paramaters
+  long double t; //time
+  int Nc;//Number of clusters its good to know
+
+  //System State
+  //agents
+  std::vector<std::vector<double>> agent_characters;
+  //cluster trackets: the members of cluster c are linked from cluster_first[c] through agent_next
+  //(flat arrays, so a system can be reinitialized without allocating)
+  std::vector<int> cluster_first;
+  std::vector<int> cluster_last;
+  std::vector<int> cluster_size;
+  std::vector<int> agent_next;
+  std::vector<int> agent_location;
+  //label of every agent in the output: its index, unless agents leave (the last agent then
+  //takes the index of the one that left) or arrive (new labels from N0)
+  std::vector<int> agent_label;
+  int next_label;
+
+  //Save Last interaction:
+  std::pair<int, int> last_link;
+  //what the last step did (arrivals and departures only happen in open systems)
+  enum Event {LINK, ARRIVAL, DEPARTURE};
+  Event last_event = LINK;
+  std::vector<int> last_departed;  //labels of the agents of the cluster that left
+
+  //Aggregation stuff
+  long double R;
+  long double normalization_factor;
+  //distances shared between systems of the same characters (null -> not shared),
+  //used by the engines that build the whole matrix
+  PairDistances *distances = nullptr;
+
+public:
+  SystemBase(int D_, int N_, long double s_,bool INTERNAL_,RandomObject &ro_);
+  virtual ~SystemBase(){}
+
+  //one Gillespie step, false once everything is in one cluster
+  virtual bool gilStep() = 0;
+  //starts a new realization with the given seed, reusing all the buffers
+  virtual void reinitialize(unsigned long long seed);
+  //copy of the realization at this point that draws its numbers from ro_
+  virtual std::unique_ptr<SystemBase> clone(RandomObject &/*ro_*/) {throw std::invalid_argument("this engine cannot be cloned");}
+
+  //copies the members of cluster c into out
+  void members(int c, std::vector<int> &out) const;
+
+  void printHP();
+  void printNC();
+  virtual void printCP(){}
+
+protected:
+  //moves the members of c2 into c1
+  void merge_clusters(int c1, int c2);
+  //open systems, O(N) per agent:
+  //new agent with new characters in a cluster of its own, returns its index (N-1)
+  int add_agent();
+  //removes cluster c and its agents (listed in members1), the agents of the highest
+  //indices take the freed indices and clusters
+  void remove_cluster(int c);
+  //time step of the Gillespie clock
+  long double time_step(long double r1);
+
+  //scratch lists for the members of the two merging clusters
+  std::vector<int> members1;
+  std::vector<int> members2;
+
+private:
+  void initNC();
+  //the last agent takes index k (k is not in any cluster anymore)
+  void move_last_agent(int k);
+  //cluster slots above N move to free slots below it
+  void compact_clusters();
+
+};
+//-----------------------------------------------------------------------
+inline SystemBase::SystemBase(int D_, int N_, long double s_,bool INTERNAL_,RandomObject &ro_)
+  :D(D_),N(N_),N0(N_),s(s_),INTERNAL(INTERNAL_),ro(&ro_){
+
+    //initialization
+    t =0;
+    Nc = N;
+    R =  2.0 / (1.0 * (N * (N)));
+    normalization_factor = 0;
+
+    //initialize the nodes and clusters
+    initNC();
+}
+//-----------------------------------------------------------------------
+inline void SystemBase::merge_clusters(int c1, int c2){
+    Nc--;
+    for (int j = cluster_first[c2]; j != -1; j = agent_next[j]) agent_location[j] = c1;
+    agent_next[cluster_last[c1]] = cluster_first[c2];
+    cluster_last[c1] = cluster_last[c2];
+    cluster_size[c1] += cluster_size[c2];
+    cluster_first[c2] = -1;
+    cluster_last[c2] = -1;
+    cluster_size[c2] = 0;
+}
+//-----------------------------------------------------------------------
+inline void SystemBase::members(int c, std::vector<int> &out) const{
+    out.clear();
+    for (int j = cluster_first[c]; j != -1; j = agent_next[j]) out.push_back(j);
+}
+//-----------------------------------------------------------------------
+inline void SystemBase::reinitialize(unsigned long long seed){
+    ro->seed(seed);
+    t = 0;
+    N = N0;
+    Nc = N;
+    R =  2.0 / (1.0 * (N * (N)));
+    last_event = LINK;
+    initNC();
+}
+//-----------------------------------------------------------------------
+inline long double SystemBase::time_step(long double r1){
+  //FIX not sure of including the normalization factor here
+  return (1.0 / (1.0 * R * normalization_factor)) * std::log(1.0 / (1.0 *r1));
+}
+//-----------------------------------------------------------------------
+inline void SystemBase::initNC(){
+    //nothing is reallocated when the sizes are already right
+    agent_characters.resize(N);
+    cluster_first.resize(N);
+    cluster_last.resize(N);
+    cluster_size.resize(N);
+    agent_next.resize(N);
+    agent_location.resize(N);
+    agent_label.resize(N);
+    next_label = N;
+    members1.reserve(N);
+    members2.reserve(N);
+
+    //initializing as monomer only with characters in unifrom distribution
+    for(int i=0; i<N; i++){
+        agent_characters[i].resize(D);
+        for (int j = 0; j < D; j++) {
+            agent_characters[i][j] = ro->get_double();
+        }
+
+        cluster_first[i] = i;
+        cluster_last[i] = i;
+        cluster_size[i] = 1;
+        agent_next[i] = -1;
+        agent_location[i] = i;
+        agent_label[i] = i;
+    }
+}
+//-----------------------------------------------------------------------
+inline int SystemBase::add_agent(){
+    int a = N;
+    agent_characters.emplace_back(D);
+    for (int j = 0; j < D; j++) agent_characters[a][j] = ro->get_double();
+    cluster_first.push_back(a);
+    cluster_last.push_back(a);
+    cluster_size.push_back(1);
+    agent_next.push_back(-1);
+    agent_location.push_back(a);
+    agent_label.push_back(next_label++);
+    N++;
+    Nc++;
+    R =  2.0 / (1.0 * (N * (N)));
+    return a;
+}
+//-----------------------------------------------------------------------
+inline void SystemBase::remove_cluster(int c){
+    members(c, members1);
+    last_departed.clear();
+    for (int a : members1) last_departed.push_back(agent_label[a]);
+    cluster_first[c] = -1;
+    cluster_last[c] = -1;
+    cluster_size[c] = 0;
+    Nc--;
+
+    //from the highest index down, so the last agent never belongs to c
+    std::sort(members1.begin(), members1.end());
+    for (int k = (int) members1.size() - 1; k >= 0; k--) move_last_agent(members1[k]);
+    compact_clusters();
+    R = (N > 0) ? 2.0 / (1.0 * (N * (N))) : 0;
+}
+//-----------------------------------------------------------------------
+inline void SystemBase::move_last_agent(int k){
+    int last = N-1;
+    if (k != last) {
+        int c = agent_location[last];
+        //the link that points to the last agent now points to k
+        if (cluster_first[c] == last) cluster_first[c] = k;
+        else {
+            int j = cluster_first[c];
+            while (agent_next[j] != last) j = agent_next[j];
+            agent_next[j] = k;
+        }
+        if (cluster_last[c] == last) cluster_last[c] = k;
+        agent_next[k] = agent_next[last];
+        agent_location[k] = c;
+        agent_label[k] = agent_label[last];
+        std::swap(agent_characters[k], agent_characters[last]);
+    }
+    agent_characters.pop_back();
+    agent_next.pop_back();
+    agent_location.pop_back();
+    agent_label.pop_back();
+    N--;
+}
+//-----------------------------------------------------------------------
+inline void SystemBase::compact_clusters(){
+    int free_slot = 0;
+    for (int c = N; c < (int) cluster_first.size(); c++) {
+        if (cluster_size[c] == 0) continue;
+        //there are at most N clusters, so a free slot is left below N
+        while (cluster_size[free_slot] > 0) free_slot++;
+        cluster_first[free_slot] = cluster_first[c];
+        cluster_last[free_slot] = cluster_last[c];
+        cluster_size[free_slot] = cluster_size[c];
+        for (int j = cluster_first[c]; j != -1; j = agent_next[j]) agent_location[j] = free_slot;
+    }
+    cluster_first.resize(N);
+    cluster_last.resize(N);
+    cluster_size.resize(N);
+}
+//-----------------------------------------------------------------------
+inline void SystemBase::printHP() {
+    std::cout << "\nHyperparameters:" << std::endl;
+    std::cout << "D: " << D << std::endl;
+    std::cout << "N: " << N << std::endl;
+    std::cout << "s: " << s << std::endl;
+    std::cout << "INTERNAL: " << (INTERNAL ? "true" : "false") << std::endl;
+}
+inline void SystemBase::printNC(){
+    std::cout << "\nAGENTS: " << std::endl;
+    int i=0;
+    for( auto vi: agent_characters){
+        std::cout << "\tAgent "<< i << ":\t " << "Character:  " ;
+        for( auto vii : vi){
+            std::cout << vii << " ";
+        }
+
+        std::cout << "\tLocation:  " << agent_location[i];
+        std::cout << std::endl;
+        i++;
+    }
+    std::cout << "\nCLUSTERS\n";
+    for (size_t i = 0; i < cluster_first.size(); ++i) {
+        if(cluster_size[i]>0){
+            std::cout << "Cluster " << i << "\t";
+            std::cout << "Members: ";
+            for (int j = cluster_first[i]; j != -1; j = agent_next[j]) {
+                std::cout << j << " ";
+            }
+            std::cout << "\n";
+        }
+
+    }
+}
+
+
+
+
+#endif //system_base_h
@@ -0,0 +1,131 @@
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include "Simulation.hpp"
+#include "Telemetry.hpp"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//  REPORTER THREAD
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+Telemetry::Telemetry(const SimParams &p, int n_workers_)
+    : path(p.status_path), interval(p.status_interval), progress(p.progress), N_rels(p.N_rels),
+      n_workers(n_workers_), workers(new WorkerStatus[n_workers_]), last_steps(n_workers_, 0),
+      stop(false), end_state("done"){
+
+    if(!(interval > 0)) throw std::invalid_argument("status interval must be positive");
+    t_start = std::chrono::steady_clock::now();
+    t_last = t_start;
+    report("running");
+    reporter = std::thread(&Telemetry::loop, this);
+}
+
+Telemetry::~Telemetry(){
+    {
+        std::lock_guard<std::mutex> lock(m);
+        stop = true;
+    }
+    cv.notify_all();
+    reporter.join();
+    try{ report(end_state); }
+    catch(...){}
+}
+
+void Telemetry::loop(){
+    std::unique_lock<std::mutex> lock(m);
+    while(!stop){
+        cv.wait_for(lock, std::chrono::duration<double>(interval));
+        if(stop) return;
+        lock.unlock();
+        //a status file that cannot be written does not stop the run
+        try{ report("running"); }
+        catch(...){}
+        lock.lock();
+    }
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//  ONE REPORT (only called by one thread at a time)
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+void Telemetry::report(const std::string &state){
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - t_start).count();
+    double dt = std::chrono::duration<double>(now - t_last).count();
+    t_last = now;
+
+    long long steps = 0;
+    long long new_steps = 0;
+    int done = 0;
+    int busy = 0;
+    int stalled = 0;
+    long long proposals = 0;
+    long long accepted = 0;
+    int switched = 0;
+    //busy worker with the most clusters left
+    int slowest_rel = -1;
+    int slowest_Nc = -1;
+    double slowest_t = 0;
+
+    std::ostringstream w;
+    for(int i=0; i<n_workers; i++){
+        WorkerStatus &ws = workers[i];
+        int rel = ws.rel.load(std::memory_order_relaxed);
+        int Nc = ws.Nc.load(std::memory_order_relaxed);
+        double t = ws.t.load(std::memory_order_relaxed);
+        long long st = ws.steps.load(std::memory_order_relaxed);
+        int rd = ws.rels_done.load(std::memory_order_relaxed);
+        bool init = ws.initializing.load(std::memory_order_relaxed);
+        proposals += ws.proposals.load(std::memory_order_relaxed);
+        accepted += ws.accepted.load(std::memory_order_relaxed);
+        switched += ws.switched.load(std::memory_order_relaxed);
+
+        long long delta = st - last_steps[i];
+        last_steps[i] = st;
+        bool is_stalled = (rel >= 0) && (delta == 0) && !init && state == "running" && dt > 0;
+
+        steps += st;
+        new_steps += delta;
+        done += rd;
+        busy += (rel >= 0);
+        stalled += is_stalled;
+        if(rel >= 0 && Nc > slowest_Nc){
+            slowest_rel = rel;
+            slowest_Nc = Nc;
+            slowest_t = t;
+        }
+
+        if(i > 0) w << ",";
+        w << "\n    {\"worker\": " << i << ", \"rel\": " << rel << ", \"Nc\": " << Nc << ", \"t\": " << t
+          << ", \"steps\": " << st << ", \"steps_per_s\": " << (dt > 0 ? delta/dt : 0)
+          << ", \"rels_done\": " << rd << ", \"initializing\": " << (init ? "true" : "false") << ", \"stalled\": " << (is_stalled ? "true" : "false") << "}";
+    }
+    double rate = (dt > 0) ? new_steps/dt : 0;
+    double acceptance = (proposals > 0) ? (double) accepted/proposals : 0;
+
+    if(path.length() > 0){
+        std::string tmp = path + ".tmp";
+        {
+            std::ofstream f(tmp);
+            if(!f.is_open()) throw std::invalid_argument("error opening status file " + tmp);
+            f << "{\n  \"state\": \"" << state << "\",\n  \"N_rels\": " << N_rels << ",\n  \"rels_done\": " << done
+              << ",\n  \"elapsed_s\": " << elapsed << ",\n  \"steps\": " << steps
+              << ",\n  \"steps_per_s\": " << rate << ",\n  \"busy_workers\": " << busy
+              << ",\n  \"stalled_workers\": " << stalled;
+            if(proposals > 0) f << ",\n  \"acceptance\": " << acceptance << ",\n  \"switched_to_matrix\": " << switched;
+            f << ",\n  \"workers\": [" << w.str() << "\n  ]\n}\n";
+        }
+        //the readers see either the previous report or this one
+        std::rename(tmp.c_str(), path.c_str());
+    }
+
+    if(progress){
+        std::ostringstream line;
+        line << "[TP " << state << " " << elapsed << "s] " << done << "/" << N_rels << " realizations, "
+             << rate << " steps/s";
+        if(slowest_rel >= 0) line << ", slowest: rel " << slowest_rel << " Nc " << slowest_Nc << " t " << slowest_t;
+        if(stalled > 0) line << ", " << stalled << " stalled";
+        if(proposals > 0) line << ", acceptance " << acceptance << " (" << switched << " switched)";
+        std::cerr << line.str() << std::endl;
+    }
+}
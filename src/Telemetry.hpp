@@ -0,0 +1,98 @@
+/*
+  Description: Live progress of a run (library TPsim).
+
+  Every worker thread owns one WorkerStatus (one cache line) and publishes into it
+  after every step with relaxed atomic stores: a few nanoseconds against the
+  microseconds of a step, and no line is shared between workers. A reporter
+  thread reads the slots every interval and
+
+    - replaces the status file (JSON) atomically: written next to it, then renamed
+    - optionally prints one line to stderr
+
+  With the rejection engine the acceptance of the finished realizations (linked over
+  proposed pairs) and how many of them switched to a matrix are reported as well.
+
+  The steps per second are measured by the reporter between two reports, a worker
+  whose steps did not move while it holds a realization is reported as stalled.
+*/
+
+#ifndef telemetry_h
+#define telemetry_h
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct SimParams;
+
+
+
+//-----------------------------------------------------------------------
+// Published by one worker thread
+//-----------------------------------------------------------------------
+struct alignas(64) WorkerStatus{
+  std::atomic<int> rel{-1};             //realization running, -1 -> idle
+  std::atomic<int> Nc{0};               //clusters left in it
+  std::atomic<double> t{0};             //its clock
+  std::atomic<long long> steps{0};      //steps of all the realizations of the worker
+  std::atomic<int> rels_done{0};
+  std::atomic<bool> initializing{false};  //building the system of rel (no steps expected)
+  //rejection engine, added at the end of every realization
+  std::atomic<long long> proposals{0};  //pairs proposed
+  std::atomic<long long> accepted{0};   //pairs linked
+  std::atomic<int> switched{0};         //realizations that went on with a matrix
+
+  void publish(int rel_, int Nc_, long double t_, long long steps_){
+    rel.store(rel_, std::memory_order_relaxed);
+    Nc.store(Nc_, std::memory_order_relaxed);
+    t.store((double) t_, std::memory_order_relaxed);
+    steps.store(steps_, std::memory_order_relaxed);
+  }
+};
+
+//-----------------------------------------------------------------------
+// Reporter of a run
+//-----------------------------------------------------------------------
+class Telemetry{
+  std::string path;
+  double interval;
+  bool progress;
+  int N_rels;
+
+  int n_workers;
+  std::unique_ptr<WorkerStatus[]> workers;
+
+  std::chrono::steady_clock::time_point t_start;
+  std::chrono::steady_clock::time_point t_last;
+  std::vector<long long> last_steps;
+
+  std::thread reporter;
+  std::mutex m;
+  std::condition_variable cv;
+  bool stop;
+  std::string end_state;
+
+public:
+  Telemetry(const SimParams &p, int n_workers_);
+  ~Telemetry(); //stops the reporter, the last report says the run is finished
+  Telemetry(const Telemetry &) = delete;
+  Telemetry& operator=(const Telemetry &) = delete;
+
+  WorkerStatus &worker(int i) {return workers[i];}
+  //state of the last report ("done" by default, "failed")
+  void finish(const std::string &state) {end_state = state;}
+
+private:
+  void loop();
+  void report(const std::string &state);
+};
+
+
+
+
+#endif //telemetry_h
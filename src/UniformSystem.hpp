@@ -0,0 +1,169 @@
+/*
+  Description: Engine for a constant kernel (s = 0). Every pair has the same propensity,
+  so the next link is a uniform pair among the live pairs and no matrix is needed:
+
+    - without INTERNAL links the live pairs are the pairs between clusters: a cluster c is
+      selected with weight size_c (N - size_c), its partner c' with weight size_c', then a
+      uniform member of each
+    - with INTERNAL links every pair that is not linked yet is live: a uniform pair is
+      drawn until it is not in the linked set (few are linked before Nc reaches 1)
+
+  The clusters keep their members in arrays and the smaller one is merged into the
+  larger, so a realization costs O(N log N) instead of O(N^2) memory and time.
+*/
+
+#ifndef uniform_system_h
+#define uniform_system_h
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <unordered_set>
+#include <vector>
+
+#include "include/RandomObject.hpp"
+#include "include/SumTree.hpp"
+#include "SystemBase.hpp"
+
+
+
+class UniformSystem : public SystemBase{
+public:
+  SumTree<double> pair_weights;  //size_c (N - size_c) of every cluster
+  SumTree<double> sizes;         //size of every cluster
+  std::vector<std::vector<int>> cluster_members;
+  std::unordered_set<long long> linked;  //pairs already linked (only with INTERNAL links)
+
+public:
+  UniformSystem(int D_, int N_, long double s_,bool INTERNAL_,RandomObject &ro_);
+
+  void aggregate(int a1, int a2);
+  bool gilStep() override;
+  void reinitialize(unsigned long long seed) override;
+  std::unique_ptr<SystemBase> clone(RandomObject &ro_) override;
+
+protected:
+  //for the engines that propose uniform pairs at any s (RejectionSystem)
+  UniformSystem(int D_, int N_, long double s_,bool INTERNAL_,RandomObject &ro_, bool any_s);
+  //a uniform pair among the pairs that can link, r uniform in [0,1) (more numbers are drawn)
+  void uniform_pair(long double r, int &a1, int &a2);
+
+private:
+  void initClusters();
+  int pick(int c);  //uniform member of cluster c
+  long long key(int a1, int a2) {return (long long) std::max(a1,a2)*N + std::min(a1,a2);}
+
+};
+//-----------------------------------------------------------------------
+inline UniformSystem::UniformSystem(int D_, int N_, long double s_,bool INTERNAL_,RandomObject &ro_)
+  :UniformSystem(D_,N_,s_,INTERNAL_,ro_,false){}
+
+inline UniformSystem::UniformSystem(int D_, int N_, long double s_,bool INTERNAL_,RandomObject &ro_, bool any_s)
+  :SystemBase(D_,N_,s_,INTERNAL_,ro_),pair_weights(N_),sizes(N_){
+
+    if (s != 0 && !any_s) throw std::invalid_argument("the uniform engine needs s = 0");
+    initClusters();
+}
+//-----------------------------------------------------------------------
+inline void UniformSystem::aggregate(int a1, int a2) {
+    int c1 = agent_location[a1];
+    int c2 = agent_location[a2];
+    if (c1 == c2 && INTERNAL == false) throw std::invalid_argument("Internal links not allowed.");
+
+    last_link.first = std::max(a1,a2);
+    last_link.second = std::min(a1,a2);
+    if (INTERNAL == true) linked.insert(key(a1, a2));
+    if (c1 == c2) return;
+
+    //the smaller cluster goes into the larger one
+    if (cluster_size[c1] < cluster_size[c2]) std::swap(c1, c2);
+    merge_clusters(c1, c2);
+    cluster_members[c1].insert(cluster_members[c1].end(), cluster_members[c2].begin(), cluster_members[c2].end());
+    cluster_members[c2].clear();
+
+    double size = cluster_size[c1];
+    sizes.set(c1, size);
+    sizes.set(c2, 0);
+    pair_weights.set(c1, size * (N - size));
+    pair_weights.set(c2, 0);
+}
+//-----------------------------------------------------------------------
+inline bool UniformSystem::gilStep() {
+
+  long double r1 = (long double)(ro->get_double());
+  long double r2 = (long double)(ro->get_double());
+
+  if (Nc ==1) {
+        return false;
+  }
+
+  t += time_step(r1);
+
+  //Event Selection + Action
+  int a1, a2;
+  uniform_pair(r2, a1, a2);
+  aggregate(a1, a2);
+  return true;
+}
+//-----------------------------------------------------------------------
+inline void UniformSystem::uniform_pair(long double r, int &a1, int &a2){
+  if (INTERNAL == true) {
+    while (true) {
+      a1 = std::min(N-1, (int) (r * N));
+      a2 = std::min(N-2, (int) (ro->get_double() * (N-1)));
+      if (a2 >= a1) a2++;
+      if (linked.count(key(a1, a2)) == 0) return;
+      r = (long double)(ro->get_double());
+    }
+  }
+
+  int c1 = pair_weights.sample((double) r * pair_weights.total());
+  int c2 = c1;
+  while (c2 == c1) {
+    //partner among the other clusters: the range of c1 is skipped
+    double val = ro->get_double() * (N - cluster_size[c1]);
+    if (val >= sizes.prefix(c1)) val += cluster_size[c1];
+    c2 = sizes.sample(val);
+  }
+  //the partner's member is drawn first, as the seeded runs always did
+  a2 = pick(c2);
+  a1 = pick(c1);
+}
+//-----------------------------------------------------------------------
+inline void UniformSystem::reinitialize(unsigned long long seed){
+    SystemBase::reinitialize(seed);
+    initClusters();
+}
+//-----------------------------------------------------------------------
+inline std::unique_ptr<SystemBase> UniformSystem::clone(RandomObject &ro_){
+    UniformSystem *c = new UniformSystem(*this);
+    c->ro = &ro_;
+    return std::unique_ptr<SystemBase>(c);
+}
+//-----------------------------------------------------------------------
+inline int UniformSystem::pick(int c){
+    const std::vector<int> &m = cluster_members[c];
+    return m[std::min((int) m.size() - 1, (int) (ro->get_double() * m.size()))];
+}
+//-----------------------------------------------------------------------
+inline void UniformSystem::initClusters(){
+    //every pair (diagonal included) has argument 0 in the softmax of CPI
+    normalization_factor = std::log(((long double) N*(N+1))/2);
+
+    cluster_members.resize(N);
+    for (int i = 0; i < N; i++) {
+        cluster_members[i].clear();
+        cluster_members[i].push_back(i);
+        sizes.set_leaf(i, 1.0);
+        pair_weights.set_leaf(i, N - 1.0);
+    }
+    sizes.rebuild();
+    pair_weights.rebuild();
+    linked.clear();
+}
+
+
+
+
+#endif //uniform_system_h
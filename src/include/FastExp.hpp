@@ -0,0 +1,141 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//					FAST EXP
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//	exp of arrays of doubles, written so the compiler vectorizes it (no branches, no
+//	calls), compiled for AVX-512, AVX2+FMA and the baseline ISA and selected at run time
+//	from the cpu (x86-64 with gcc/clang, elsewhere the baseline loop only).
+//
+//	- exp(x) = 2^n exp(r), n = round(x/ln2), |r| <= ln2/2, exp(r) by its Taylor
+//	  polynomial of degree 13 (truncation below 5e-18, under 0.05 ulp)
+//	- error below 2 ulp on [-708, 709] against a long double reference (checked on
+//	  1e8 points), the last bit can differ between ISAs (FMA)
+//	- x < -708 gives 0 (the subnormal range is flushed), x > 709 gives exp(709)
+////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef fast_exp_h
+#define fast_exp_h
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+
+////////////////////////////////////////////////////////////////////////////////////////
+//						CLASS DEFINITION
+////////////////////////////////////////////////////////////////////////////////////////
+
+class FastExp{
+public:
+	enum Isa {BASELINE, AVX2, AVX512};
+
+	//v[i] = exp(v[i]), returns the sum of the results
+	static double exp_sum(double *v, long long n);
+	static Isa isa();
+	static const char* isa_name();
+
+private:
+	static inline double exp1(double x) __attribute__((always_inline));
+	static inline double exp_sum_body(double *v, long long n) __attribute__((always_inline));
+	static double exp_sum_baseline(double *v, long long n);
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+	__attribute__((target("avx2,fma"))) static double exp_sum_avx2(double *v, long long n);
+	__attribute__((target("avx512f"))) static double exp_sum_avx512(double *v, long long n);
+#endif
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+//						kernel
+////////////////////////////////////////////////////////////////////////////////////////
+inline double FastExp::exp1(double x){
+	const double LOG2E = 1.4426950408889634074;
+	const double LN2_HI = 6.93147180369123816490e-01;	//ln2 with 21 trailing zero bits
+	const double LN2_LO = 1.90821492927058770002e-10;
+	const double ROUND = 6755399441055744.0;			//1.5 * 2^52
+
+	double xc = std::min(std::max(x, -708.0), 709.0);
+	//t - ROUND is xc/ln2 rounded to an integer, the low bits of t hold it
+	double t = xc*LOG2E + ROUND;
+	double n = t - ROUND;
+	double r = (xc - n*LN2_HI) - n*LN2_LO;
+
+	double p = 1.0/6227020800.0;
+	p = p*r + 1.0/479001600.0;
+	p = p*r + 1.0/39916800.0;
+	p = p*r + 1.0/3628800.0;
+	p = p*r + 1.0/362880.0;
+	p = p*r + 1.0/40320.0;
+	p = p*r + 1.0/5040.0;
+	p = p*r + 1.0/720.0;
+	p = p*r + 1.0/120.0;
+	p = p*r + 1.0/24.0;
+	p = p*r + 1.0/6.0;
+	p = p*r + 0.5;
+	p = p*r + 1.0;
+	p = p*r + 1.0;
+
+	//2^n from the exponent bits (n + 1023 is in [1, 2046])
+	uint64_t bits;
+	std::memcpy(&bits, &t, sizeof(bits));
+	bits = (bits + 1023) << 52;
+	double scale;
+	std::memcpy(&scale, &bits, sizeof(scale));
+	return (x < -708.0) ? 0.0 : p*scale;
+}
+
+inline double FastExp::exp_sum_body(double *v, long long n){
+	//eight partial sums, so the sum vectorizes without reassociation
+	double acc[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+	long long n8 = n - n%8;
+	for(long long i=0; i<n8; i += 8){
+		for(int k=0; k<8; k++){
+			v[i+k] = exp1(v[i+k]);
+			acc[k] += v[i+k];
+		}
+	}
+	for(long long i=n8; i<n; i++){
+		v[i] = exp1(v[i]);
+		acc[0] += v[i];
+	}
+	return ((acc[0] + acc[1]) + (acc[2] + acc[3])) + ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+}
+
+inline double FastExp::exp_sum_baseline(double *v, long long n){ return exp_sum_body(v, n); }
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+__attribute__((target("avx2,fma"))) inline double FastExp::exp_sum_avx2(double *v, long long n){ return exp_sum_body(v, n); }
+__attribute__((target("avx512f"))) inline double FastExp::exp_sum_avx512(double *v, long long n){ return exp_sum_body(v, n); }
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////
+//						dispatch
+////////////////////////////////////////////////////////////////////////////////////////
+inline FastExp::Isa FastExp::isa(){
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+	static const Isa detected = __builtin_cpu_supports("avx512f") ? AVX512
+								: (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) ? AVX2 : BASELINE;
+	return detected;
+#else
+	return BASELINE;
+#endif
+}
+
+inline const char* FastExp::isa_name(){
+	static const char* names[] = {"baseline", "avx2", "avx512"};
+	return names[isa()];
+}
+
+inline double FastExp::exp_sum(double *v, long long n){
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+	Isa i = isa();
+	if(i == AVX512) return exp_sum_avx512(v, n);
+	if(i == AVX2) return exp_sum_avx2(v, n);
+#endif
+	return exp_sum_baseline(v, n);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//						END OF HEADER FILE
+////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
@@ -4,12 +4,24 @@
 //
 //	https://math.stackexchange.com/questions/646117/how-to-find-a-function-mapping-matrix-indices
 //
+//	- the indices are calculated each time instead of being stored in maps, the maps
+//	  were several times bigger than the array itself
+//	- the array lives in a MappedArray, so it can be placed in a scratch file when
+//	  it does not fit in memory (backing_dir)
+//	- block_sum is the sampling index: the sum of every block of BLOCK elements.
+//	  The selection walks the block sums and then a single block, so it reads the
+//	  array sequentially and touches only one block of it per step
+//	- partition() splits the blocks between the members of a ThreadTeam, every
+//	  member keeps the sum of its partition and zeroes only its own elements
+//	- compact() drops the zero elements: arr keeps the nonzero ones in order, live
+//	  their indices in the triangle. get, set, zero_pairs and the searches still take
+//	  and return indices of the triangle (a binary search of live), so the callers
+//	  do not see it; the selection and the memory follow the pairs that can still
+//	  link instead of dim^2. A compacted triangle cannot change its size
+//
 //	possible modification:
-//		
+//
 //		- create overflow protection
-//		- instead of creating maps should the indices be calculated each time
-//			what is more efficient (one memory and one computation)
-//			can test later
 ////////////////////////////////////////////////////////////////////////////////////////
 
 
@@ -17,12 +29,17 @@
 #ifndef lower_triangle_h
 #define lower_triangle_h
 
+#include <algorithm>
 #include <iostream>
-#include <map>
 #include <math.h>
 #include <numeric>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
+#include "MappedArray.hpp"
+#include "ThreadTeam.hpp"
+
 
 ////////////////////////////////////////////////////////////////////////////////////////
 //						CLASS DEFINITION
@@ -30,43 +47,70 @@
 
 
 template <typename T> class LowerTriangle{
-	
+
 public:
-	int dim; 	//dimension 
-	int size;	//total size
-	std::vector<T> arr;
-	
+	static const long long BLOCK = MappedArray<T>::BLOCK;
+
+	int dim; 	//dimension
+	long long size;	//elements in arr (the whole triangle unless compacted)
+	MappedArray<T> arr;
+	MappedArray<T> block_sum;	//sum of each block of arr (sampling index)
+	MappedArray<long long> live;	//compacted: index in the triangle of every element of arr
+	bool is_compact = false;
+
 	//have the total value of the lower triangle already
 	T cumulative; //this is the cumulative of lower triangle including diagonal only
 
+	std::string backing_dir;	//empty -> memory, otherwise scratch files in this directory
 
-	//to create an easy search table
-	std::map<int, std::pair<int,int> > map_index;
-	std::map<std::pair<int,int>,int > map_row_col;
+	//partitions for a thread team (empty if not partitioned)
+	std::vector<long long> part_begin;	//first block of every partition, and the end
+	std::vector<T> part_sum;			//sum of every partition
+	std::vector<std::vector<std::vector<long long>>> outbox;	//[from][to] indices to zero
+	std::vector<std::vector<long long>> inbox;
 
 public:
-	LowerTriangle(int dim_);
+	LowerTriangle(int dim_, const std::string &backing_dir_ = "");
 	LowerTriangle(const LowerTriangle & lt);
+	LowerTriangle(LowerTriangle && lt) noexcept;
+	LowerTriangle& operator=(LowerTriangle && lt) noexcept;
 	~LowerTriangle();
 	//main setters and getters
 	void set(int r, int c, T val);
-	void set(int i, T val);
+	void set(long long i, T val);
 	T get(int r, int c);
-	T get(int i);
+	T get(long long i);
+	//zeroing all the pairs between two groups (in increasing index order)
+	void zero_pairs(const std::vector<int> &group1, const std::vector<int> &group2);
+	void zero_pairs(const std::vector<int> &group1, const std::vector<int> &group2, ThreadTeam &team);
 	//changing the size
-	void remove(int n);
+	void remove(int n);		//the last row/column takes the place of n
 	void add();
 	void resize(int new_dim);
 
 	//retrieving some variables
 	int get_dim();
-	int get_size();
-	int get_index(int row, int col);
-	int get_row(int index);
-	int get_col(int index);
+	long long get_size();
+	long long get_index(int row, int col);
+	int get_row(long long index);
+	int get_col(long long index);
 	T get_cum();
 	//function to get index of first element that exceeds the cumulative sum
-	int search_exceeds_cum(T value);
+	long long search_exceeds_cum(T value);
+	long long search_exceeds_cum(T value, ThreadTeam &team);
+	//splitting the blocks in n_parts partitions
+	void partition(int n_parts);
+	//every member of the team first-touches its own partition (the values become zero,
+	//the caller refills them)
+	void place(ThreadTeam &team);
+	//recomputes the block sums and the cumulative after writing to arr directly
+	void rebuild_index();
+	//keeps only the nonzero elements (new storage, the old one is given back)
+	void compact();
+	bool compacted() const {return is_compact;}
+
+	//memory needed for a given dimension (array + index)
+	static long double bytes_needed(int dim_);
 
 	//printing functions
 	void print_array();
@@ -79,93 +123,121 @@ public:
 
 
 private:
-	int get_index_from_row_col(int row, int col);
-	int get_row_from_index(int index);
-	int get_col_from_index(int index);
+	static long long get_index_from_row_col(int row, int col);
+	static int get_row_from_index(long long index);
+	static int get_col_from_index(long long index);
+	long long last_positive(long long block);
+	//element of arr holding a triangle index (-1 if a compacted triangle dropped it) and back
+	long long position(long long index);
+	long long position(long long index, long long from);
+	long long index_of(long long pos) {return is_compact ? live[pos] : pos;}
+	void set_at(long long pos, T val);
+	void check_resizable();
+	long long search_blocks(long long b_begin, long long b_end, T val);
+	int part_of_block(long long b);
 
 };
 
 ////////////////////////////////////////////////////////////////////////////////////////
 //						Constructor/Deconstructor
 ////////////////////////////////////////////////////////////////////////////////////////
-template <typename T> LowerTriangle<T>::LowerTriangle(int dim_): dim(dim_){
+template <typename T> LowerTriangle<T>::LowerTriangle(int dim_, const std::string &backing_dir_)
+: dim(dim_), backing_dir(backing_dir_){
 	//determining size
-	size= (int) ((dim*(dim+1))*0.5);
-	//creating the matrix and search table
-	arr.resize(size,0);
-	for(int i=0; i<size ; i++){
-		 map_index[i] = {get_row_from_index(i),get_col_from_index(i)};
-		 map_row_col[{get_row_from_index(i),get_col_from_index(i)}] = i;
-	}
-	cumulative = std::accumulate(arr.begin(), arr.end(), 0);
+	size= ((long long) dim*(dim+1))/2;
+	//creating the matrix and its index (both start at zero)
+	arr = MappedArray<T>(size, backing_dir);
+	block_sum = MappedArray<T>((size + BLOCK - 1)/BLOCK, backing_dir);
+	cumulative = 0;
 }
 template<typename T> LowerTriangle<T>::LowerTriangle(const LowerTriangle  & lt):
-dim(lt.dim),size(lt.size), arr(lt.arr),map_index(lt.map_index),map_row_col(lt.map_row_col){}
+dim(lt.dim),size(lt.size), arr(lt.arr), block_sum(lt.block_sum), live(lt.live), is_compact(lt.is_compact), cumulative(lt.cumulative){}
+template<typename T> LowerTriangle<T>::LowerTriangle(LowerTriangle && lt) noexcept:
+dim(lt.dim),size(lt.size), arr(std::move(lt.arr)), block_sum(std::move(lt.block_sum)),
+live(std::move(lt.live)), is_compact(lt.is_compact), cumulative(lt.cumulative), backing_dir(std::move(lt.backing_dir)),
+part_begin(std::move(lt.part_begin)), part_sum(std::move(lt.part_sum)),
+outbox(std::move(lt.outbox)), inbox(std::move(lt.inbox)){}
+template<typename T> LowerTriangle<T>& LowerTriangle<T>::operator=(LowerTriangle && lt) noexcept{
+	dim = lt.dim;
+	size = lt.size;
+	arr = std::move(lt.arr);
+	block_sum = std::move(lt.block_sum);
+	live = std::move(lt.live);
+	is_compact = lt.is_compact;
+	cumulative = lt.cumulative;
+	backing_dir = std::move(lt.backing_dir);
+	part_begin = std::move(lt.part_begin);
+	part_sum = std::move(lt.part_sum);
+	outbox = std::move(lt.outbox);
+	inbox = std::move(lt.inbox);
+	return *this;
+}
 template <typename T> LowerTriangle<T>::~LowerTriangle(){}
 
 
 ////////////////////////////////////////////////////////////////////////////////////////
-//						Constructor/Deconstructor
+//						changing the size
 ////////////////////////////////////////////////////////////////////////////////////////
 
+// the last row/column takes the place of n (as when the last agent gets the index of a
+// removed one), so only 2*dim elements move instead of the whole tail of the array
 template <typename T>  void LowerTriangle<T>::remove(int n){
-	
+
+	check_resizable();
 	if(n>=dim) throw std::invalid_argument("cant remove that element matrix size exceeded");
 
-	for(int i=0; i<dim; i++){
-		cumulative -= arr[get_index(n,i)-i];
-		arr.erase(arr.begin()+ (get_index(n,i)-i));
-	}	
-	size = size - dim; 
+	int last = dim-1;
+	if(n != last){
+		for(int c=0; c<last; c++){
+			if(c != n) set(get_index_from_row_col(n,c), arr[get_index_from_row_col(last,c)]);
+		}
+		set(get_index_from_row_col(n,n), arr[get_index_from_row_col(last,last)]);
+	}
+	//the last row is dropped from the sums before the array shrinks (which zeroes it)
+	for(long long i=size-dim; i<size; i++) set(i, 0);
+	size = size - dim;
 	dim = dim-1;
-
-	//No need to resize the index maps we can just keep them and increse them when needed
-	
+	arr.resize(size);
+	block_sum.resize((size + BLOCK - 1)/BLOCK);
+	if(!part_sum.empty()) partition(part_sum.size());
 }
 template <typename T> void LowerTriangle<T>::add(){
+	check_resizable();
 	//getting the new dimensions
 	int dim_new = dim+1;
-	int size_new = size+ dim_new;
+	long long size_new = size+ dim_new;
 
-	arr.resize(size_new,0);
+	arr.resize(size_new);
+	block_sum.resize((size_new + BLOCK - 1)/BLOCK);
 
-	//check if we need to increase the maps	
-	if(size_new>size){
-		for(int i=size; i<size_new; i++){
-			map_index[i] = {get_row_from_index(i),get_col_from_index(i)};
-		 	map_row_col[{get_row_from_index(i),get_col_from_index(i)}] = i;
-		}
-	}
 	dim = dim_new;
 	size = size_new;
+	if(!part_sum.empty()) partition(part_sum.size());
 
 }
 
 // Add this member function to the LowerTriangle class
 template <typename T>
 void LowerTriangle<T>::resize(int new_dim) {
+    check_resizable();
     if (new_dim < dim) {
         throw std::invalid_argument("Cannot resize to a smaller dimension");
     }
 
     // Calculate the new size
-    int new_size = (int)((new_dim * (new_dim + 1)) * 0.5);
+    long long new_size = ((long long) new_dim * (new_dim + 1)) / 2;
 
-    // Resize the array
-    arr.resize(new_size, 0);
+    // Resize the array (new elements are zero)
+    arr.resize(new_size);
+    block_sum.resize((new_size + BLOCK - 1)/BLOCK);
 
     // Update dimension and size
     dim = new_dim;
     size = new_size;
-
-    // Recreate the index maps
-    map_index.clear();
-    map_row_col.clear();
-
-    for (int i = 0; i < size; i++) {
-        map_index[i] = {get_row_from_index(i), get_col_from_index(i)};
-        map_row_col[{get_row_from_index(i), get_col_from_index(i)}] = i;
-    }
+    if(!part_sum.empty()) partition(part_sum.size());
+}
+template <typename T> void LowerTriangle<T>::check_resizable(){
+	if(is_compact) throw std::invalid_argument("a compacted lower triangle cannot change its size");
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////
@@ -174,26 +246,87 @@ void LowerTriangle<T>::resize(int new_dim) {
 
 template <typename T> T LowerTriangle<T>::get(int r, int c){
 	if(r>= dim || c>= dim) throw std::invalid_argument("exceeds dim");
-	return arr[map_row_col[{std::max(r,c),std::min(r,c)}]];	
+	return get(get_index_from_row_col(r,c));
 }
-template <typename T> T LowerTriangle<T>::get(int i){
-	if(i>=size) throw std::invalid_argument("exceeds size");
-	return arr[i];	
+template <typename T> T LowerTriangle<T>::get(long long i){
+	long long pos = position(i);
+	return (pos < 0) ? 0 : arr[pos];
 }
 template <typename T> void LowerTriangle<T>::set(int r, int c, T val){
 	if(r>= dim || c>= dim) throw std::invalid_argument("exceeds dim");
-	//editing cumulative
-	cumulative -= arr[map_row_col[{std::max(r,c),std::min(r,c)}]];
-	cumulative += val;
-	//setting the array
-	arr[map_row_col[{std::max(r,c),std::min(r,c)}]] = val;	
+	set(get_index_from_row_col(r,c), val);
 }
-template <typename T> void LowerTriangle<T>::set(int i ,T val){
+template <typename T> void LowerTriangle<T>::set(long long i ,T val){
+	long long pos = position(i);
+	if(pos >= 0) set_at(pos, val);
+	else if(val != 0) throw std::invalid_argument("the compacted lower triangle dropped that element");
+}
+template <typename T> void LowerTriangle<T>::set_at(long long i ,T val){
 	if(i>=size) throw std::invalid_argument("exceeds size");
-	//editing the cumulative
+	//editing the cumulative and the index
 	cumulative -= arr[i];
 	cumulative += val;
-	arr[i] = val;	
+	block_sum[i/BLOCK] += val - arr[i];
+	if(!part_sum.empty()) part_sum[part_of_block(i/BLOCK)] += val - arr[i];
+	arr[i] = val;
+}
+template <typename T>
+void LowerTriangle<T>::zero_pairs(const std::vector<int> &group1, const std::vector<int> &group2){
+	//sorting the indices so the array is streamed once instead of jumping around
+	std::vector<long long> indices;
+	indices.reserve(group1.size()*group2.size());
+	for(int i : group1){
+		for(int j : group2) indices.push_back(get_index_from_row_col(i,j));
+	}
+	std::sort(indices.begin(), indices.end());
+	if(!is_compact){
+		for(long long i : indices) set_at(i, 0);
+		return;
+	}
+	//the positions increase with the indices, every search starts from the last one
+	long long from = 0;
+	for(long long i : indices){
+		long long pos = position(i, from);
+		if(pos < 0) continue;
+		set_at(pos, 0);
+		from = pos;
+	}
+}
+template <typename T>
+void LowerTriangle<T>::zero_pairs(const std::vector<int> &group1, const std::vector<int> &group2, ThreadTeam &team){
+	int n_parts = part_sum.size();
+	if(n_parts != team.size()) throw std::invalid_argument("lower triangle is not partitioned for this team");
+
+	auto job = [&](int tid){
+		//phase 1: the indices of a share of group1 are sent to the owners of their blocks
+		std::vector<std::vector<long long>> &out = outbox[tid];
+		for(auto &o : out) o.clear();
+		size_t n1 = group1.size();
+		for(size_t k = (tid*n1)/n_parts; k < ((tid+1)*n1)/n_parts; k++){
+			for(int j : group2){
+				long long index = position(get_index_from_row_col(group1[k], j));
+				if(index >= 0) out[part_of_block(index/BLOCK)].push_back(index);
+			}
+		}
+		team.barrier();
+
+		//phase 2: every member zeroes its own elements, in increasing order
+		std::vector<long long> &in = inbox[tid];
+		in.clear();
+		for(int from=0; from<n_parts; from++) in.insert(in.end(), outbox[from][tid].begin(), outbox[from][tid].end());
+		std::sort(in.begin(), in.end());
+		T delta = 0;
+		for(long long index : in){
+			block_sum[index/BLOCK] -= arr[index];
+			delta -= arr[index];
+			arr[index] = 0;
+		}
+		part_sum[tid] += delta;
+	};
+	team.run(job);
+
+	cumulative = 0;
+	for(T ps : part_sum) cumulative += ps;
 }
 
 
@@ -201,82 +334,175 @@ template <typename T> void LowerTriangle<T>::set(int i ,T val){
 //						getters and setters of object
 ////////////////////////////////////////////////////////////////////////////////////////
 template <typename T> int LowerTriangle<T>::get_dim() {return dim;}
-template <typename T> int LowerTriangle<T>::get_size() {return size;}
-template <typename T> int LowerTriangle<T>::get_index(int r, int c){ return map_row_col[{std::max(r,c),std::min(r,c)}]; }
-template <typename T> int LowerTriangle<T>::get_row(int index) {return map_index[index].first;}
-template <typename T> int LowerTriangle<T>::get_col(int index) {return map_index[index].second;}
-template <typename T> T LowerTriangle<T>::get_cum(){ 
+template <typename T> long long LowerTriangle<T>::get_size() {return size;}
+template <typename T> long long LowerTriangle<T>::get_index(int r, int c){ return get_index_from_row_col(r,c); }
+template <typename T> int LowerTriangle<T>::get_row(long long index) {return get_row_from_index(index);}
+template <typename T> int LowerTriangle<T>::get_col(long long index) {return get_col_from_index(index);}
+template <typename T> T LowerTriangle<T>::get_cum(){
 	return cumulative;
 }
+template <typename T> long double LowerTriangle<T>::bytes_needed(int dim_){
+	long double n = 0.5L*dim_*(dim_+1.0L);
+	return (n + n/BLOCK)*sizeof(T);
+}
 
 ////////////////////////////////////////////////////////////////////////////////////////
 //						searching algorithm
 ////////////////////////////////////////////////////////////////////////////////////////
 template <typename T>
-int LowerTriangle<T>::search_exceeds_cum(T val) {
-    
-	std::vector<T> a;
-    T cum_sum = 0;
-
-//#########DBUGGING
-// std::cout << "******* printing cum sum *******" << std::endl;
-    
-    int i=0;
-    for (i=0; i <= size; i++) {
-
-    	a.push_back(cum_sum);
-        cum_sum += arr[i];
-
-// std::cout << i <<"\t" <<cum_sum << "\t" << val << "\t" << get_cum()<< "\t" << std::reduce(arr.begin(), arr.end())<< std::endl;
-
-        if (cum_sum >= val) {
-            return i;
-        }
-    }
-
-// std::cout << std::fixed << std::setprecision(std::numeric_limits<float>::max_digits10)<< std::endl;
-for(i=size-10; i<size+1; i++){
-	std::cout <<  a[i] << std::endl;
+long long LowerTriangle<T>::search_exceeds_cum(T val) {
+	long long n_blocks = block_sum.size();
+	long long index = search_blocks(0, n_blocks, val);
+	//rounding errors of the running sums can leave val just above the total
+	if(index < 0) return index_of(last_positive(n_blocks-1));
+	return index_of(index);
 }
+template <typename T>
+long long LowerTriangle<T>::search_exceeds_cum(T val, ThreadTeam &team) {
+	int n_parts = part_sum.size();
+	if(n_parts != team.size()) throw std::invalid_argument("lower triangle is not partitioned for this team");
+
+	long long found = -1;
+	auto job = [&](int tid){
+		//every member refreshes the sum of its partition from its block sums
+		T sum = 0;
+		for(long long b=part_begin[tid]; b<part_begin[tid+1]; b++) sum += block_sum[b];
+		part_sum[tid] = sum;
+		team.barrier();
+
+		//the member whose partition holds val searches it
+		T start = 0;
+		for(int p=0; p<tid; p++) start += part_sum[p];
+		bool last = (tid == n_parts-1);
+		if(part_sum[tid] > 0 && start < val && (val <= start + part_sum[tid] || last)){
+			found = search_blocks(part_begin[tid], part_begin[tid+1], val - start);
+		}
+		else if(tid == 0 && !(val > 0) && part_sum[0] > 0){
+			found = search_blocks(part_begin[0], part_begin[1], val);
+		}
+	};
+	team.run(job);
 
-// //     //it shouldnt reach here by why is it
-// std::cout <<a[size-1] <<"\t" <<a[i] << "  " << a[i-1] << std::endl;
-// std::cout << cum_sum << "  " << val << std::endl;
-// std::cout << dim << "  " << size << std::endl;
-
-
-    throw std::invalid_argument("search_algo =the value exceed the matrix");
-    // If the loop completes without finding a matching index, return a value indicating not found.
-    return -1;
+	if(found < 0) return index_of(last_positive(block_sum.size()-1));
+	return index_of(found);
 }
-// template <typename T> int  LowerTriangle<T>::search_exceeds_cum(T val){
-// 	//creating the cumulative sum matrix
-// 	std::vector<T> cum_sum;
-// 	cum_sum.resize(arr.size());
-//     std::partial_sum(arr.begin(),arr.end(),cum_sum.begin());
-//     //getting the index
-//     int index = std::lower_bound(cum_sum.begin(), cum_sum.end(),val)- cum_sum.begin();
-
-//     if(index>= cum_sum.size()){
-//     	std::cout << "Max Index: " << cum_sum.size() << " " <<arr.size() << std::endl;
-// 	    std::cout << "Searched Value: " << val <<  "Out of: " <<  get_cum() <<std::endl;
-// 	    std::cout << "Computed Index: " << index << std::endl;
-
-// 	    std::cout << "Array at index" <<arr[index-1] << std::endl;
+// first element of the blocks [b_begin, b_end) where the cumulative sum reaches val (-1 if none)
+template <typename T>
+long long LowerTriangle<T>::search_blocks(long long b_begin, long long b_end, T val) {
 
-//     	throw std::invalid_argument("search_algo =the value exceed the matrix");
+	T cum_sum = 0;
 
-//     }
-//     if((index-1)<0){
-//     	std::cout << "Max Index: " << cum_sum.size()-1 << std::endl;
-// 	    std::cout << "Searched Value: " << val << std::endl;
-// 	    std::cout << "Computed Index: " << index << std::endl;
+	//finding the block
+	long long b=b_begin;
+	for (b=b_begin; b < b_end; b++) {
+		if (cum_sum + block_sum[b] >= val && block_sum[b] > 0) break;
+		cum_sum += block_sum[b];
+	}
+	if (b == b_end) return -1;
 
-//     	throw std::invalid_argument("search_algo = the value is -1");
-//     }
-//     return index;
-   
-// }
+	//finding the element inside the block
+	long long end = std::min(size, (b+1)*BLOCK);
+	for (long long i = b*BLOCK; i < end; i++) {
+		cum_sum += arr[i];
+		if (cum_sum >= val && arr[i] > 0) {
+			return i;
+		}
+	}
+	return last_positive(b);
+}
+template <typename T> long long LowerTriangle<T>::last_positive(long long block){
+	for(long long b=block; b>=0; b--){
+		if(!(block_sum[b] > 0)) continue;
+		for(long long i=std::min(size, (b+1)*BLOCK)-1; i>=b*BLOCK; i--){
+			if(arr[i] > 0) return i;
+		}
+	}
+	throw std::invalid_argument("search_algo =the value exceed the matrix");
+	return -1;
+}
+template <typename T> void LowerTriangle<T>::partition(int n_parts){
+	long long n_blocks = block_sum.size();
+	part_begin.resize(n_parts+1);
+	part_sum.assign(n_parts, 0);
+	for(int p=0; p<=n_parts; p++) part_begin[p] = (p*n_blocks)/n_parts;
+	for(int p=0; p<n_parts; p++){
+		for(long long b=part_begin[p]; b<part_begin[p+1]; b++) part_sum[p] += block_sum[b];
+	}
+	//the buffers are kept when the partitioning does not change
+	if((int) outbox.size() != n_parts){
+		outbox.assign(n_parts, std::vector<std::vector<long long>>(n_parts));
+		inbox.assign(n_parts, std::vector<long long>());
+	}
+}
+template <typename T> void LowerTriangle<T>::place(ThreadTeam &team){
+	if(part_begin.size() != (size_t) team.size() + 1) partition(team.size());
+	arr.release_pages();
+	block_sum.release_pages();
+	auto job = [&](int tid){
+		arr.touch(part_begin[tid]*BLOCK, part_begin[tid+1]*BLOCK);
+		block_sum.touch(part_begin[tid], part_begin[tid+1]);
+	};
+	team.run(job);
+	cumulative = 0;
+	std::fill(part_sum.begin(), part_sum.end(), 0);
+}
+template <typename T> int LowerTriangle<T>::part_of_block(long long b){
+	return (int) (std::upper_bound(part_begin.begin(), part_begin.end(), b) - part_begin.begin()) - 1;
+}
+template <typename T> void LowerTriangle<T>::rebuild_index(){
+	long long n_blocks = block_sum.size();
+	cumulative = 0;
+	for(long long b=0; b<n_blocks; b++){
+		T sum = 0;
+		long long end = std::min(size, (b+1)*BLOCK);
+		for(long long i=b*BLOCK; i<end; i++) sum += arr[i];
+		block_sum[b] = sum;
+		cumulative += sum;
+	}
+	if(!part_sum.empty()) partition(part_sum.size());
+}
+template <typename T> void LowerTriangle<T>::compact(){
+	long long n = 0;
+	for(long long i=0; i<size; i++) n += (arr[i] != 0);
+
+	MappedArray<T> arr_new(n, backing_dir);
+	MappedArray<long long> live_new(n, backing_dir);
+	long long k = 0;
+	for(long long i=0; i<size; i++){
+		if(arr[i] == 0) continue;
+		arr_new[k] = arr[i];
+		live_new[k] = index_of(i);
+		k++;
+	}
+	arr = std::move(arr_new);
+	live = std::move(live_new);
+	size = n;
+	is_compact = true;
+	block_sum = MappedArray<T>((size + BLOCK - 1)/BLOCK, backing_dir);
+	rebuild_index();
+}
+template <typename T> long long LowerTriangle<T>::position(long long index){
+	if(!is_compact){
+		if(index<0 || index>=size) throw std::invalid_argument("exceeds size");
+		return index;
+	}
+	return position(index, 0);
+}
+template <typename T> long long LowerTriangle<T>::position(long long index, long long from){
+	//galloping from the hint: sorted indices of a merge are mostly close to each other
+	const long long *begin = live.data();
+	for(long long end = std::min(size, from + 8); from < end; from++){
+		if(live[from] >= index) return (live[from] == index) ? from : -1;
+	}
+	long long lo = from - 1, step = 1;
+	if(lo < 0) lo = 0;
+	while(lo + step < size && live[lo + step] < index){
+		lo += step;
+		step *= 2;
+	}
+	const long long *p = std::lower_bound(begin + lo, begin + std::min(size, lo + step + 1), index);
+	return (p != begin + size && *p == index) ? p - begin : -1;
+}
 ////////////////////////////////////////////////////////////////////////////////////////
 //						printing the array
 ////////////////////////////////////////////////////////////////////////////////////////
@@ -301,51 +527,48 @@ template <typename T> void LowerTriangle<T>::print_lower_triangle(){
 }
 template <typename T> void LowerTriangle<T>::print_indexed(){
 	T cum_sum =0;
-	for(int i=0; i<size; i++){
+	for(long long i=0; i<size; i++){
 		cum_sum += arr[i];
-		std::cout << i  << " ( " << map_index[i].first << " , " << map_index[i].second << ") --> " << arr[i] <<"\t" << cum_sum <<std::endl;
+		long long index = index_of(i);
+		std::cout << index  << " ( " << get_row(index) << " , " << get_col(index) << ") --> " << arr[i] <<"\t" << cum_sum <<std::endl;
 
 	}
 }
 ////////////////////////////////////////////////////////////////////////////////////////
-//						private functions for initializing the matrix
+//						private functions for the indices
 ////////////////////////////////////////////////////////////////////////////////////////
 
-template <typename T> int LowerTriangle<T>::get_index_from_row_col(int row, int col){
-	return ((0.5*std::max(row,col)*(std::max(row,col)+1))+(std::min(row,col)+1))-1;
+template <typename T> long long LowerTriangle<T>::get_index_from_row_col(int row, int col){
+	long long r = std::max(row,col);
+	return (r*(r+1))/2 + std::min(row,col);
 }
 
-template <typename T> int LowerTriangle<T>::get_row_from_index(int index){
-	return (int) (std::ceil(sqrt(2 *(index+1) + 0.25) - 0.5)-1);
+template <typename T> int LowerTriangle<T>::get_row_from_index(long long index){
+	long long row = (long long) ((sqrtl(8.0L*index + 1.0L) - 1.0L)/2.0L);
+	//correcting the rounding of the square root
+	while((row*(row+1))/2 > index) row--;
+	while(((row+1)*(row+2))/2 <= index) row++;
+	return (int) row;
 }
 
-template <typename T> int LowerTriangle<T>::get_col_from_index(int index){
-	int row = get_row_from_index(index);
-	return ((index+1) - ((row*(row+1))/2) )-1; 
+template <typename T> int LowerTriangle<T>::get_col_from_index(long long index){
+	long long row = get_row_from_index(index);
+	return (int) (index - (row*(row+1))/2);
 }
 
 
 template <typename T>
 void LowerTriangle<T>::reset(const LowerTriangle<T> &other) {
-    // Clear current contents
-    arr.clear();
-    map_index.clear();
-    map_row_col.clear();
-
     // Copy data from the other LowerTriangle
     dim = other.dim;
     size = other.size;
     cumulative = other.cumulative;
 
-    // Resize the array
-    arr.resize(size, 0);
-
     // Copy values from the other LowerTriangle
-    for (int i = 0; i < size; i++) {
-        arr[i] = other.arr[i];
-        map_index[i] = {get_row_from_index(i), get_col_from_index(i)};
-        map_row_col[{get_row_from_index(i), get_col_from_index(i)}] = i;
-    }
+    arr = other.arr;
+    block_sum = other.block_sum;
+    live = other.live;
+    is_compact = other.is_compact;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////
@@ -355,4 +578,3 @@ void LowerTriangle<T>::reset(const LowerTriangle<T> &other) {
 
 
 #endif
-
@@ -0,0 +1,287 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//					MAPPED ARRAY
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//	Flat array of trivially copyable elements that lives either in anonymous memory
+//	or in a scratch file on disk (memory mapped), so that arrays bigger than RAM
+//	can be paged to a local drive by the kernel.
+//
+//	- the capacity is always a whole number of blocks (BLOCK elements), so block
+//	  boundaries fall on page boundaries and a block can be paged in on its own
+//	- new elements are zero (anonymous pages / ftruncate both give zeros)
+//	- the scratch file is unlinked right after creation, it disappears with the
+//	  process even if it crashes
+//	- anonymous pages are only placed when first written, touch() lets the thread
+//	  that will use a range place it (NUMA first touch)
+//	- map_private() maps a range of an existing file copy on write: the pages are
+//	  read from the file when used, writes stay private to the process
+//	- memory_file() is file backed without a disk (memfd on Linux), so that its
+//	  content can be mapped copy on write by several arrays
+////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef mapped_array_h
+#define mapped_array_h
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////////////
+//						CLASS DEFINITION
+////////////////////////////////////////////////////////////////////////////////////////
+
+template <typename T> class MappedArray{
+
+public:
+	static const long long BLOCK = 4096;	//elements per block
+
+private:
+	T* ptr;
+	long long n;		//number of elements in use
+	long long cap;		//number of elements mapped (multiple of BLOCK)
+	int fd;				//-1 if anonymous
+	std::string dir;	//directory of the scratch file (empty if anonymous)
+	bool cow;			//private (copy on write) mapping of a file
+
+public:
+	MappedArray();
+	MappedArray(long long n_, const std::string &dir_ = "");
+	//n elements of file path from offset (multiple of the page size), the file must hold
+	//the whole capacity (n rounded up to BLOCK)
+	static MappedArray map_private(const std::string &path, long long offset, long long n_);
+	static MappedArray map_private(int file, long long offset, long long n_);
+	//n elements in a file in memory (an unlinked scratch file in the temp directory where
+	//memfd is not available)
+	static MappedArray memory_file(long long n_);
+	MappedArray(const MappedArray &other);
+	MappedArray(MappedArray &&other) noexcept;
+	MappedArray& operator=(const MappedArray &other);
+	MappedArray& operator=(MappedArray &&other) noexcept;
+	~MappedArray();
+
+	T& operator[](long long i) {return ptr[i];}
+	const T& operator[](long long i) const {return ptr[i];}
+	T* data() {return ptr;}
+	const T* data() const {return ptr;}
+	T* begin() {return ptr;}
+	T* end() {return ptr+n;}
+	long long size() const {return n;}
+	long long capacity() const {return cap;}
+	bool is_file_backed() const {return fd >= 0;}
+	int file() const {return fd;}
+	bool is_cow() const {return cow;}
+
+	void resize(long long n_);
+	void clear();
+	void fill_zero();
+
+	//placement of anonymous memory (nothing happens for scratch files)
+	void advise_huge_pages();						//transparent huge pages for pages not placed yet
+	void release_pages();							//gives the pages back, the elements become zero
+	void touch(long long begin, long long end);		//places the pages of [begin, end) from this thread
+
+private:
+	void map(long long cap_);
+	void unmap();
+	static long long round_up(long long n_) {return ((n_ + BLOCK - 1) / BLOCK) * BLOCK;}
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+//						Constructor/Deconstructor
+////////////////////////////////////////////////////////////////////////////////////////
+template <typename T> MappedArray<T>::MappedArray(): ptr(nullptr), n(0), cap(0), fd(-1), cow(false){}
+
+template <typename T> MappedArray<T>::MappedArray(long long n_, const std::string &dir_)
+: ptr(nullptr), n(0), cap(0), fd(-1), dir(dir_), cow(false){
+	if(dir.length() > 0){
+		std::string templ = dir + "/lt_XXXXXX";
+		std::vector<char> name(templ.begin(), templ.end());
+		name.push_back('\0');
+		fd = mkstemp(name.data());
+		if(fd < 0) throw std::invalid_argument("cant create scratch file in " + dir);
+		unlink(name.data());
+	}
+	resize(n_);
+}
+
+template <typename T> MappedArray<T> MappedArray<T>::map_private(const std::string &path, long long offset, long long n_){
+	if(round_up(n_) == 0) return MappedArray();
+	int f = open(path.c_str(), O_RDONLY);
+	if(f < 0) throw std::invalid_argument("cant open " + path);
+	try{
+		MappedArray out = map_private(f, offset, n_);
+		close(f);	//the mapping keeps the file
+		return out;
+	}
+	catch(const std::invalid_argument &){
+		close(f);
+		throw std::invalid_argument("cant map " + path);
+	}
+}
+
+template <typename T> MappedArray<T> MappedArray<T>::map_private(int file, long long offset, long long n_){
+	MappedArray out;
+	long long cap_ = round_up(n_);
+	if(cap_ == 0) return out;
+	void* p = mmap(nullptr, (size_t) cap_ * sizeof(T), PROT_READ | PROT_WRITE, MAP_PRIVATE, file, (off_t) offset);
+	if(p == MAP_FAILED) throw std::invalid_argument("cant map file");
+	out.ptr = (T*) p;
+	out.n = n_;
+	out.cap = cap_;
+	out.cow = true;
+	return out;
+}
+
+template <typename T> MappedArray<T> MappedArray<T>::memory_file(long long n_){
+	MappedArray out;
+	#if defined(__linux__) && defined(MFD_CLOEXEC)
+	out.fd = memfd_create("MappedArray", MFD_CLOEXEC);
+	#endif
+	if(out.fd < 0){
+		const char* tmp = std::getenv("TMPDIR");
+		std::string templ = std::string(tmp ? tmp : "/tmp") + "/lt_XXXXXX";
+		std::vector<char> name(templ.begin(), templ.end());
+		name.push_back('\0');
+		out.fd = mkstemp(name.data());
+		if(out.fd < 0) throw std::invalid_argument("cant create scratch file in " + templ);
+		unlink(name.data());
+	}
+	out.resize(n_);
+	return out;
+}
+
+template <typename T> MappedArray<T>::MappedArray(const MappedArray &other)
+: ptr(nullptr), n(0), cap(0), fd(-1), cow(false){
+	//copies always live in memory
+	resize(other.n);
+	if(n > 0) std::memcpy(ptr, other.ptr, n*sizeof(T));
+}
+
+template <typename T> MappedArray<T>::MappedArray(MappedArray &&other) noexcept
+: ptr(other.ptr), n(other.n), cap(other.cap), fd(other.fd), dir(std::move(other.dir)), cow(other.cow){
+	other.ptr = nullptr; other.n = 0; other.cap = 0; other.fd = -1; other.cow = false;
+}
+
+template <typename T> MappedArray<T>& MappedArray<T>::operator=(const MappedArray &other){
+	if(this == &other) return *this;
+	resize(other.n);
+	if(n > 0) std::memcpy(ptr, other.ptr, n*sizeof(T));
+	return *this;
+}
+
+template <typename T> MappedArray<T>& MappedArray<T>::operator=(MappedArray &&other) noexcept{
+	if(this == &other) return *this;
+	unmap();
+	if(fd >= 0) close(fd);
+	ptr = other.ptr; n = other.n; cap = other.cap; fd = other.fd; dir = std::move(other.dir); cow = other.cow;
+	other.ptr = nullptr; other.n = 0; other.cap = 0; other.fd = -1; other.cow = false;
+	return *this;
+}
+
+template <typename T> MappedArray<T>::~MappedArray(){
+	unmap();
+	if(fd >= 0) close(fd);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//						changing the size
+////////////////////////////////////////////////////////////////////////////////////////
+
+// new elements are zero, the capacity grows geometrically so repeated growth is amortized
+template <typename T> void MappedArray<T>::resize(long long n_){
+	if(n_ <= cap){
+		//zero the tail that was given up so regrowing gives zeros again
+		if(n_ < n) std::memset(ptr+n_, 0, (n-n_)*sizeof(T));
+		n = n_;
+		return;
+	}
+	long long cap_new = round_up(std::max(n_, cap + cap/2));
+	map(cap_new);
+	n = n_;
+}
+
+template <typename T> void MappedArray<T>::clear(){
+	unmap();
+	cow = false;
+	n = 0;
+	cap = 0;
+}
+
+template <typename T> void MappedArray<T>::fill_zero(){
+	if(n > 0) std::memset(ptr, 0, n*sizeof(T));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//						placement
+////////////////////////////////////////////////////////////////////////////////////////
+template <typename T> void MappedArray<T>::advise_huge_pages(){
+	#if defined(MADV_HUGEPAGE)
+	if(fd < 0 && ptr != nullptr) madvise((void*) ptr, (size_t) cap * sizeof(T), MADV_HUGEPAGE);
+	#endif
+}
+
+template <typename T> void MappedArray<T>::release_pages(){
+	if(fd >= 0 || ptr == nullptr) return;
+	#if defined(MADV_DONTNEED) && defined(__linux__)
+	//private anonymous pages read back as zero after MADV_DONTNEED (a private file mapping
+	//would read back the file, it is zeroed instead)
+	if(!cow && madvise((void*) ptr, (size_t) cap * sizeof(T), MADV_DONTNEED) == 0) return;
+	#endif
+	fill_zero();
+}
+
+template <typename T> void MappedArray<T>::touch(long long begin, long long end){
+	if(fd >= 0) return;
+	long long step = std::max(1L, sysconf(_SC_PAGESIZE) / (long) sizeof(T));
+	volatile T* p = ptr;
+	for(long long i = begin; i < std::min(end, n); i += step) p[i] = p[i];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//						private functions for the mapping
+////////////////////////////////////////////////////////////////////////////////////////
+
+template <typename T> void MappedArray<T>::map(long long cap_){
+	size_t bytes = (size_t) cap_ * sizeof(T);
+	void* p;
+	if(fd >= 0){
+		//the file keeps the old content, only the mapping is recreated
+		if(ftruncate(fd, (off_t) bytes) != 0) throw std::invalid_argument("cant grow scratch file");
+		unmap();
+		p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if(p == MAP_FAILED) throw std::invalid_argument("cant map scratch file");
+	}
+	else{
+		p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(p == MAP_FAILED) throw std::bad_alloc();
+		if(ptr != nullptr && n > 0) std::memcpy(p, ptr, n*sizeof(T));
+		unmap();
+		cow = false;
+	}
+	ptr = (T*) p;
+	cap = cap_;
+}
+
+template <typename T> void MappedArray<T>::unmap(){
+	if(ptr != nullptr) munmap((void*) ptr, (size_t) cap * sizeof(T));
+	ptr = nullptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//						END OF HEADER FILE
+////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
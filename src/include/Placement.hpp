@@ -0,0 +1,131 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//					PLACEMENT
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//	Thread pinning and NUMA information (Linux only, elsewhere nothing is pinned and
+//	every cpu is on node 0).
+//
+//	- cpus() lists the cpus the process may run on grouped by NUMA node, so that
+//	  consecutive cpus (a worker and its thread team) share a node
+//	- pin() binds the calling thread to one cpu, AffinityGuard gives the thread its
+//	  previous cpus back when it goes out of scope
+//	- Linux places a page on the node of the thread that first writes it, a pinned
+//	  thread that first-touches its own memory keeps it local
+////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef placement_h
+#define placement_h
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////////////
+//						CLASS DEFINITION
+////////////////////////////////////////////////////////////////////////////////////////
+
+class Placement{
+public:
+	struct Cpu{
+		int id;
+		int node;
+	};
+
+	//cpus allowed to the process, ordered by node
+	static std::vector<Cpu> cpus();
+	static int n_nodes(const std::vector<Cpu> &list);
+	//pins the calling thread to cpu, false if it is not possible
+	static bool pin(int cpu);
+
+private:
+	static int node_of(int cpu);
+};
+
+class AffinityGuard{
+#if defined(__linux__)
+	cpu_set_t saved;
+	bool ok;
+#endif
+public:
+	AffinityGuard();
+	~AffinityGuard();
+	AffinityGuard(const AffinityGuard &) = delete;
+	AffinityGuard& operator=(const AffinityGuard &) = delete;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+//						cpus and nodes
+////////////////////////////////////////////////////////////////////////////////////////
+inline std::vector<Placement::Cpu> Placement::cpus(){
+	std::vector<Cpu> list;
+#if defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if(sched_getaffinity(0, sizeof(set), &set) == 0){
+		for(int c=0; c<CPU_SETSIZE; c++) if(CPU_ISSET(c, &set)) list.push_back({c, node_of(c)});
+	}
+#endif
+	if(list.empty()) list.push_back({0, 0});
+	std::stable_sort(list.begin(), list.end(), [](const Cpu &a, const Cpu &b){ return a.node < b.node; });
+	return list;
+}
+
+inline int Placement::n_nodes(const std::vector<Cpu> &list){
+	int n = 0;
+	for(auto &c : list) n = std::max(n, c.node + 1);
+	return n;
+}
+
+//the sysfs directory of a cpu holds a nodeK link
+inline int Placement::node_of(int cpu){
+	std::error_code ec;
+	std::filesystem::directory_iterator it("/sys/devices/system/cpu/cpu" + std::to_string(cpu), ec);
+	if(ec) return 0;
+	for(auto &entry : it){
+		std::string name = entry.path().filename().string();
+		if(name.rfind("node", 0) == 0 && name.size() > 4 && std::all_of(name.begin()+4, name.end(), ::isdigit)){
+			return std::stoi(name.substr(4));
+		}
+	}
+	return 0;
+}
+
+inline bool Placement::pin(int cpu){
+#if defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+	return false;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//						saving the cpus of a thread
+////////////////////////////////////////////////////////////////////////////////////////
+#if defined(__linux__)
+inline AffinityGuard::AffinityGuard(){
+	CPU_ZERO(&saved);
+	ok = (sched_getaffinity(0, sizeof(saved), &saved) == 0);
+}
+inline AffinityGuard::~AffinityGuard(){
+	if(ok) sched_setaffinity(0, sizeof(saved), &saved);
+}
+#else
+inline AffinityGuard::AffinityGuard(){}
+inline AffinityGuard::~AffinityGuard(){}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////
+//						END OF HEADER FILE
+////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
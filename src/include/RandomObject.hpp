@@ -12,6 +12,9 @@ class RandomObject{
 public:
     RandomObject();
     RandomObject(int seed);
+    void seed(unsigned long long seed);
+    //seed taken from the clock, as the default constructor does
+    static unsigned long long clock_seed();
     double get_double();
     int get_int(int start, int end);
 };
@@ -26,6 +29,12 @@ inline RandomObject::RandomObject(int seed){
 
     generator.seed(seed);    
 }
+inline void RandomObject::seed(unsigned long long seed){
+    generator.seed(seed);
+}
+inline unsigned long long RandomObject::clock_seed(){
+    return std::chrono::system_clock::now().time_since_epoch().count();
+}
 inline double RandomObject::get_double(){
     std::uniform_real_distribution<double> distribution;
     return distribution(generator);
@@ -0,0 +1,103 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//					SUM TREE
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//	Binary tree over n non negative weights: every node holds the sum of its two
+//	children, the root holds the total.
+//	set and sample are O(log n), the leaves are stored at [cap, 2 cap).
+////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef sum_tree_h
+#define sum_tree_h
+
+#include <stdexcept>
+#include <vector>
+
+
+////////////////////////////////////////////////////////////////////////////////////////
+//						CLASS DEFINITION
+////////////////////////////////////////////////////////////////////////////////////////
+
+template <typename T> class SumTree{
+
+	int n;		//number of weights
+	int cap;	//number of leaves (power of 2)
+	std::vector<T> tree;
+
+public:
+	SumTree(int n_ = 0);
+
+	void resize(int n_);
+	void set(int i, T val);
+	T get(int i) const {return tree[cap+i];}
+	T total() const {return tree[1];}
+	int size() const {return n;}
+	//index of the first weight where the cumulative sum reaches val (skips zero weights)
+	int sample(T val) const;
+	//sum of the weights before i
+	T prefix(int i) const;
+	//writes a weight without updating the sums (call rebuild after writing all of them)
+	void set_leaf(int i, T val) {tree[cap+i] = val;}
+	void rebuild();
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+//						Constructor
+////////////////////////////////////////////////////////////////////////////////////////
+template <typename T> SumTree<T>::SumTree(int n_): n(0), cap(1){
+	resize(n_);
+}
+
+template <typename T> void SumTree<T>::resize(int n_){
+	n = n_;
+	cap = 1;
+	while(cap < n) cap *= 2;
+	tree.assign(2*cap, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//						setters and sampling
+////////////////////////////////////////////////////////////////////////////////////////
+template <typename T> void SumTree<T>::set(int i, T val){
+	if(i >= n) throw std::invalid_argument("sum tree: exceeds size");
+	int node = cap + i;
+	tree[node] = val;
+	for(node /= 2; node >= 1; node /= 2) tree[node] = tree[2*node] + tree[2*node+1];
+}
+
+template <typename T> int SumTree<T>::sample(T val) const{
+	int node = 1;
+	while(node < cap){
+		T left = tree[2*node];
+		//going right when the value is past the left child (or the left child is empty)
+		if(val > left || !(left > 0)){
+			if(tree[2*node+1] > 0){
+				val -= left;
+				node = 2*node+1;
+				continue;
+			}
+		}
+		node = 2*node;
+	}
+	if(!(tree[node] > 0)) throw std::invalid_argument("sum tree: nothing to sample");
+	return node - cap;
+}
+
+template <typename T> T SumTree<T>::prefix(int i) const{
+	T sum = 0;
+	//every right child adds its left sibling
+	for(int node = cap + i; node > 1; node /= 2){
+		if(node & 1) sum += tree[node-1];
+	}
+	return sum;
+}
+
+template <typename T> void SumTree<T>::rebuild(){
+	for(int node = cap-1; node >= 1; node--) tree[node] = tree[2*node] + tree[2*node+1];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//						END OF HEADER FILE
+////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
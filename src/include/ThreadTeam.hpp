@@ -0,0 +1,136 @@
+////////////////////////////////////////////////////////////////////////////////////////
+//					THREAD TEAM
+////////////////////////////////////////////////////////////////////////////////////////
+//
+//	Persistent team of threads for the work inside one realization.
+//	Starting a job and waiting for it are spin barriers, a simulation step is a few
+//	microseconds so opening an OpenMP region (or waking sleeping threads) every
+//	step would cost more than the step itself.
+//
+//	- the calling thread is member 0 of the team, run() returns when all are done
+//	- barrier() can be called inside a job to separate its phases
+//	- the spinning yields after a while so an idle team does not starve other work
+//	- given a list of cpus, member tid pins itself to cpus[tid] (member 0 is the
+//	  caller and is left as it is)
+////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef thread_team_h
+#define thread_team_h
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "Placement.hpp"
+
+
+////////////////////////////////////////////////////////////////////////////////////////
+//						SPIN BARRIER
+////////////////////////////////////////////////////////////////////////////////////////
+
+class SpinBarrier{
+	int n;
+	std::atomic<int> count;
+	std::atomic<int> generation;
+
+public:
+	SpinBarrier(int n_): n(n_), count(0), generation(0){}
+	void wait();
+
+	static void pause(int &spins);
+};
+
+inline void SpinBarrier::wait(){
+	int gen = generation.load(std::memory_order_acquire);
+	if(count.fetch_add(1, std::memory_order_acq_rel) == n-1){
+		//last one in releases the others
+		count.store(0, std::memory_order_relaxed);
+		generation.fetch_add(1, std::memory_order_release);
+		return;
+	}
+	int spins = 0;
+	while(generation.load(std::memory_order_acquire) == gen) pause(spins);
+}
+
+inline void SpinBarrier::pause(int &spins){
+	if(spins < 4096){
+		spins++;
+		#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+		#endif
+	}
+	else std::this_thread::yield();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//						CLASS DEFINITION
+////////////////////////////////////////////////////////////////////////////////////////
+
+class ThreadTeam{
+	int n;
+	std::vector<std::thread> workers;
+	SpinBarrier start_barrier;
+	SpinBarrier done_barrier;
+	SpinBarrier inner_barrier;
+	std::atomic<bool> stop;
+	std::vector<int> cpus;
+
+	//current job
+	void (*call)(void*, int);
+	void *ctx;
+
+public:
+	ThreadTeam(int n_, const std::vector<int> &cpus_ = std::vector<int>());
+	~ThreadTeam();
+	ThreadTeam(const ThreadTeam &) = delete;
+	ThreadTeam& operator=(const ThreadTeam &) = delete;
+
+	int size() const {return n;}
+	//runs f(tid) on every member of the team
+	template <class F> void run(F &f);
+	void barrier() {inner_barrier.wait();}
+
+private:
+	void work(int tid);
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+//						Constructor/Deconstructor
+////////////////////////////////////////////////////////////////////////////////////////
+inline ThreadTeam::ThreadTeam(int n_, const std::vector<int> &cpus_)
+: n(n_), start_barrier(n_), done_barrier(n_), inner_barrier(n_), stop(false), cpus(cpus_), call(nullptr), ctx(nullptr){
+	for(int tid=1; tid<n; tid++) workers.emplace_back(&ThreadTeam::work, this, tid);
+}
+
+inline ThreadTeam::~ThreadTeam(){
+	stop.store(true, std::memory_order_release);
+	start_barrier.wait();
+	for(auto &w : workers) w.join();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//						running jobs
+////////////////////////////////////////////////////////////////////////////////////////
+template <class F> void ThreadTeam::run(F &f){
+	ctx = (void*) &f;
+	call = [](void *c, int tid){ (*(F*) c)(tid); };
+	start_barrier.wait();
+	f(0);
+	done_barrier.wait();
+}
+
+inline void ThreadTeam::work(int tid){
+	if(tid < (int) cpus.size()) Placement::pin(cpus[tid]);
+	while(true){
+		start_barrier.wait();
+		if(stop.load(std::memory_order_acquire)) return;
+		call(ctx, tid);
+		done_barrier.wait();
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+//						END OF HEADER FILE
+////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
@@ -2,9 +2,15 @@
 #ifndef utils_h
 #define utils_h
 
+#include <algorithm>
 #include <chrono>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
 #include <string>
 #include <sstream>
+#include <vector>
 
 
 #define EPS 1.0e-6
@@ -1,35 +1,51 @@
+#include <algorithm>
 #include <iostream>
-#include <fstream>  // Include the necessary library for file operations
 #include <filesystem>
+#include <sstream>
 
 #if defined(_OPENMP)
    #include <omp.h>
 #endif
 
-#include  "include/RandomObject.hpp"
+#include "include/FastExp.hpp"
 #include "include/utils.hpp"
 
-#include "System.hpp"
+#include "Simulation.hpp"
+#include "Reducers.hpp"
 
 //----------------------------------------------
-// Global variables for hyperparameters
-int N_rels;
-int D;
-int N;
-long double s;
-bool INTERNAL;
+// Parameters of the run (hyperparameters and options)
+SimParams params;
 
 //direcotry stuff
 std::string dir;
 std::string data_folder;
 std::string time_str;
+//several s on the same characters (--s-list), one data folder per s
+std::vector<long double> s_list;
+std::vector<std::string> s_folders;
+//output: files (one pair of csv per realization), summary (reducers) or both
+std::string output = "files";
+ReduceOptions reduce_options;
 
 //----------------------------------------------
-void run_sim(int rel);
-
+// The sinks of one data folder
+struct FolderSinks{
+    std::string folder;
+    std::unique_ptr<CsvSink> csv;
+    std::unique_ptr<ReducerSink> reducer;
+    std::unique_ptr<TeeSink> tee;
+    SimSink *sink;
+
+    FolderSinks(const std::string &folder_);
+    void finish(); //writes the summary
+};
 
+//----------------------------------------------
 void set_dirs();
+std::string folder_of(long double s);
 void set_global(int argc, char **argv);
+void set_option(std::string opt);
 
 
 void print_one(int argc, char **argv);
@@ -43,7 +59,7 @@ void dev();
 //////////////////////////////////////////////////////////////////////////////////////////////////////
 // IF NO ARGUMENTS PROVIDED RUNS TEST
 // Input should be of the form: (total = 7)
-//  ./main.out N_rels INTERNAL D N s  "dir/"
+//  ./main.out N_rels INTERNAL D N s  "dir/" [--options]
 //      -N_rels:                number of realizations [ integer > 0]  
 //      -INTERNAL:              wether or not to have internal links [ 0->no , 1 -> yes]
 //      -D   (INT)              DIMENSION OF CHAT          
@@ -51,6 +67,59 @@ void dev();
 //      -s     (double )        selectivity par
 //      -"dir/":                directory to put data
 //                              if empty then saves in current working directory 
+//  options:
+//      --mem-budget=GB         memory for the propensity matrices of all the threads,
+//                              above it they are placed in memory mapped scratch files
+//      --mmap-dir=path         directory of the scratch files (default: data directory, the
+//                              one of the first s of a sweep)
+//      --engine=name           matrix (default): stored propensity matrix
+//                              rowsum: matrix free, O(N) memory, O(N D) per step
+//                              uniform: s = 0 only (automatic with matrix), samples the
+//                              merges from the cluster sizes, O(N log N) per realization
+//                              rejection: matrix free, uniform pairs accepted with their
+//                              propensity, O(N D) memory, switches to a matrix when the
+//                              acceptance collapses
+//      --min-acceptance=A      acceptance below which the rejection engine switches to a
+//                              matrix (default 0.01, 0 -> never)
+//      --rel-threads=P         threads working on one realization (matrix engine),
+//                              the realizations run on max_threads/P threads
+//      --seed=S                realization rel is seeded with S + rel (default: clock)
+//      --lanes=L               4, 8 or 16: every thread runs L realizations in lockstep
+//                              (EnsembleSystem), for small N
+//      --status=path           status file (JSON) of the run, replaced every interval
+//      --status-interval=S     seconds between two status reports (default 10)
+//      --progress              one status line per report on stderr
+//      --pin                   pins every thread to a cpu, a worker and its team on one
+//                              NUMA node; each thread first-touches its own memory
+//      --huge-pages            transparent huge pages for the propensity matrices
+//      --matrix-cache=dir      initialized propensity matrices are stored in dir and loaded
+//                              from it when a realization is run again (same seed)
+//      --softmax=kernel        exp of the normalization of the matrix: fast (default,
+//                              vectorized, double precision) or long (long double)
+//      --compact-below=F       without internal links the matrix keeps only the pairs that
+//                              can still link once they are fewer than F of it (default
+//                              0.05, 0 -> never)
+//      --arrival-rate=L        open system (matrix engine): new agents arrive at rate L
+//      --departure-rate=M      every cluster leaves at rate M
+//      --t-max=T               end of the open realizations (needed with arrivals),
+//                              arrivals and departures go to <time>-<rel>.event.csv
+//      --clones=K              every realization goes on as K clones from the point set by
+//      --clone-at-nc=M         Nc <= M or
+//      --clone-at-t=T          t >= T (matrix, rowsum or uniform engine); clone k of
+//                              realization rel is written as realization rel*K + k
+//      --s-list=s1,s2,...      runs every s on the same characters (the positional s is
+//                              not used), the distances are computed once per draw
+//      --coupling=name         crn (default): the s share the random numbers of the dynamics
+//                              independent: they only share the characters
+//      --distances=prec        storage of the shared distances: double (default), long,
+//                              float or u16, memory mapped with the matrices over the
+//                              memory budget
+//      --output=kind           files (default): node and edge csv of every realization
+//                              summary: only the ensemble summary of the folder
+//                              both
+//      --nc-grid=t_max:n       time grid of the mean and variance of Nc(t) in the summary
+//                              (or log:t_min:t_max:n), no Nc(t) without it
+//      --distance-bins=B       bins of the merge distance histogram (default 50)
 //////////////////////////////////////////////////////////////////////////////////////////////////////
 int main(int argc, char **argv){
 
@@ -65,11 +134,22 @@ int main(int argc, char **argv){
         print_two();
         //running the realizations
         #if defined(_OPENMP)
-        std::cout << "USING  [" << omp_get_max_threads() << "] THREADS" << std::endl;
-        #pragma omp parallel for
+        std::cout << "USING  [" << parallel_realizations(params) << "] x [" << params.rel_threads << "] THREADS" << std::endl;
         #endif
-        for(int rel=0; rel < N_rels; rel++){
-            run_sim(rel);
+        if(s_list.size()>0){
+            std::vector<std::unique_ptr<FolderSinks>> sinks;
+            std::vector<SimSink*> sink_ptrs;
+            for(auto &folder : s_folders){
+                sinks.emplace_back(new FolderSinks(folder));
+                sink_ptrs.push_back(sinks.back()->sink);
+            }
+            run_sweep(params, s_list, sink_ptrs);
+            for(auto &fs : sinks) fs->finish();
+        }
+        else{
+            FolderSinks sinks(data_folder);
+            run_simulation(params, *sinks.sink);
+            sinks.finish();
         }
 
     }
@@ -77,85 +157,92 @@ int main(int argc, char **argv){
     std::cout << "\t\t PROGRAM END" << std::endl;
     std::cout << "--------------------------------------------------------------" << std::endl;
     return 1;
-}
-//////////////////////////////////////////////////////////////////////////////////////////////////////
-//  THIS IS WHERE THE SIMULATION IS RUNNING
-//////////////////////////////////////////////////////////////////////////////////////////////////////
-void run_sim(int rel){
-
-    //okay first lets decide whats the data we are gonna write 
-    std::string str_nodes = data_folder+"/"+time_str+"-"+std::to_string(rel)+".node.csv";
-    std::string str_edges = data_folder+"/"+time_str+"-"+std::to_string(rel)+".edge.csv";
-    //making the folders
-    std::ofstream node_file(str_nodes);
-    std::ofstream edge_file(str_edges);
-
-    // Check if the file is opened successfully
-    if (!node_file.is_open()) throw std::invalid_argument("error opening node file");
-    if (!edge_file.is_open()) throw std::invalid_argument("error opening edge file");
-
-    node_file << "NodeLabel";
-    for(int i=0; i<D; i++) node_file << ",x" << i;
-    node_file << std::endl;
-    edge_file << "Node1,Node2,Step,Time" << std::endl;
-
-    //initializing the system
-    RandomObject ro = RandomObject();
-    System sys(D,N,s,INTERNAL,ro);
-
-    // //saving the nodes to a file
-    // for(int i=0; i<s.N; i++) node_file << i << "," << s.agent_types[i] << std::endl;
-    //saving the nodes to a file
-    for(int i=0; i< sys.N; i++){
-        node_file << i;
-        for(int j =0; j<D; j++) node_file << "," << sys.agent_characters[i][j];
-        node_file << std::endl;
-    }
-
-
-
-    //THIS IS WHERE THE SIMULATION RUNS
-    bool cont= true;
-    int counter = 0;
-    while(cont){
-        // std::cout << "STEP: " <<counter << std::endl;
-        if(counter!=0) edge_file << sys.last_link.first << "," << sys.last_link.second << "," << counter << "," << sys.t << std::endl;
-        
-        cont = sys.gilStep();
-        counter++;
-    }
-    // std::cout << "STEP: " <<counter << std::endl;
-    edge_file << sys.last_link.first << "," << sys.last_link.second << "," << counter << "," << sys.t << std::endl;
-    //closing the folder
-    node_file.close();
-    edge_file.close();
-
-
 }
 //////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////////
 void set_global(int argc, char **argv){
+    //splitting the options from the positional arguments
+    std::vector<std::string> args;
+    for(int i=1; i<argc; i++){
+        std::string arg = argv[i];
+        if(arg.rfind("--",0)==0) set_option(arg);
+        else args.push_back(arg);
+    }
     //N_rels
-    N_rels = std::stoi(argv[1]);
+    params.N_rels = std::stoi(args[0]);
     //Internal
-    if(std::stoi(argv[2])==0) INTERNAL = false;
-    else if(std::stoi(argv[2])==1) INTERNAL = true;
-    D = std::stoi(argv[3]);
-    N = std::stoi(argv[4]);
-    s = std::stod(argv[5]);
+    if(std::stoi(args[1])==0) params.INTERNAL = false;
+    else if(std::stoi(args[1])==1) params.INTERNAL = true;
+    params.D = std::stoi(args[2]);
+    params.N = std::stoi(args[3]);
+    params.s = std::stod(args[4]);
 
-    dir = argv[argc-1];
+    dir = args[5];
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+void set_option(std::string opt){
+    size_t eq = opt.find('=');
+    std::string name = opt.substr(2, eq==std::string::npos ? std::string::npos : eq-2);
+    std::string value = eq==std::string::npos ? "" : opt.substr(eq+1);
+
+    if(name=="mem-budget") params.mem_budget = std::stold(value);
+    else if(name=="mmap-dir") params.mmap_dir = value;
+    else if(name=="engine") params.engine = value;
+    else if(name=="seed") params.seed = std::stoll(value);
+    else if(name=="status") params.status_path = value;
+    else if(name=="status-interval") params.status_interval = std::stod(value);
+    else if(name=="progress") params.progress = true;
+    else if(name=="pin") params.pin = true;
+    else if(name=="huge-pages") params.huge_pages = true;
+    else if(name=="matrix-cache") params.matrix_cache = value;
+    else if(name=="softmax") params.softmax = value;
+    else if(name=="compact-below") params.compact_below = std::stod(value);
+    else if(name=="min-acceptance") params.min_acceptance = std::stod(value);
+    else if(name=="arrival-rate") params.arrival_rate = std::stold(value);
+    else if(name=="departure-rate") params.departure_rate = std::stold(value);
+    else if(name=="t-max") params.t_max = std::stold(value);
+    else if(name=="clones") params.clones = std::stoi(value);
+    else if(name=="clone-at-nc") params.clone_at_nc = std::stoi(value);
+    else if(name=="clone-at-t") params.clone_at_t = std::stold(value);
+    else if(name=="s-list"){
+        std::stringstream ss(value);
+        std::string item;
+        s_list.clear();
+        while(std::getline(ss, item, ',')) s_list.push_back(std::stold(item));
+        if(s_list.empty()) throw std::invalid_argument("empty s list");
+    }
+    else if(name=="coupling") params.coupling = value;
+    else if(name=="output"){
+        if(value!="files" && value!="summary" && value!="both") throw std::invalid_argument("output must be files, summary or both");
+        output = value;
+    }
+    else if(name=="nc-grid") reduce_options.nc_grid = ReduceOptions::parse_grid(value);
+    else if(name=="distance-bins") reduce_options.distance_bins = std::stoi(value);
+    else if(name=="distances") params.distance_precision = value;
+    else if(name=="rel-threads") params.rel_threads = std::max(1, std::stoi(value));
+    else if(name=="lanes"){
+        params.lanes = std::stoi(value);
+        if(params.lanes!=1 && params.lanes!=4 && params.lanes!=8 && params.lanes!=16) throw std::invalid_argument("lanes must be 1, 4, 8 or 16");
+    }
+    else throw std::invalid_argument("unknown option " + opt);
 }
 //////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////////
 void set_dirs(){
     //CHECKING IF THE DIRECTORY IS PROPER
     if (!((dir[dir.length()-1] == '/' )) && (dir.length()>0)) throw std::invalid_argument("directory is not valid ");
-    std::string strInternal = "";
-    if(INTERNAL) strInternal = "INTERNAL_";
-    data_folder = dir+strInternal+"D_"+tostr(D) +"_N_"+tostr(N) +"_s_"+tostr(s);
-    std::filesystem::create_directories(data_folder);
+    data_folder = folder_of(params.s);
+    if(s_list.empty()) std::filesystem::create_directories(data_folder);
+    s_folders.clear();
+    for(long double s : s_list){
+        s_folders.push_back(folder_of(s));
+        std::filesystem::create_directories(s_folders.back());
+    }
     time_str = get_time_string();
+    //the scratch files go next to the data by default (the folder of the first s of a sweep,
+    //the one of the positional s is not created then)
+    if(params.mmap_dir.length()==0) params.mmap_dir = s_list.empty() ? data_folder : s_folders.front();
 }
 //////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -171,23 +258,78 @@ void print_one(int argc, char **argv){
     std::cout << std::endl;
     std::cout << "--------------------------------------------------------------" << std::endl;
     int Nargs = 7;
-    if(argc!=Nargs) throw std::invalid_argument("wrong number of arguments");
+    int n_positional = 1;
+    for(int i=1; i<argc; i++) if(std::string(argv[i]).rfind("--",0)!=0) n_positional++;
+    if(n_positional!=Nargs) throw std::invalid_argument("wrong number of arguments");
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+FolderSinks::FolderSinks(const std::string &folder_): folder(folder_), sink(nullptr){
+    if(output!="summary") csv.reset(new CsvSink(folder, time_str));
+    if(output!="files") reducer.reset(new ReducerSink(reduce_options));
+    if(csv && reducer){
+        tee.reset(new TeeSink({csv.get(), reducer.get()}));
+        sink = tee.get();
+    }
+    else if(csv) sink = csv.get();
+    else sink = reducer.get();
+}
+void FolderSinks::finish(){
+    if(reducer) reducer->write(folder, time_str);
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+std::string folder_of(long double s){
+    std::string strInternal = "";
+    if(params.INTERNAL) strInternal = "INTERNAL_";
+    return dir+strInternal+"D_"+tostr(params.D) +"_N_"+tostr(params.N) +"_s_"+tostr(s);
 }
 //////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////////
 void print_two(){
     std::cout << "\t\t INPUT ARGUEMTNS" << std::endl;
     std::cout << "--------------------------------------------------------------" << std::endl;
-    std::cout << "Number of Realizations: " << N_rels << std::endl;
-    std::cout << "Dimension: " << D << std::endl;
-    std::cout << "(N): " << N << std::endl;
-    std::cout << "(s): " << s << std::endl;
-    std::cout << "Internal Links (0:False 1:True): " << INTERNAL << std::endl;
+    std::cout << "Number of Realizations: " << params.N_rels << std::endl;
+    std::cout << "Dimension: " << params.D << std::endl;
+    std::cout << "(N): " << params.N << std::endl;
+    if(s_list.size()>0){
+        std::cout << "(s): ";
+        for(long double s : s_list) std::cout << s << " ";
+        std::cout << "(" << params.coupling << ", " << params.distance_precision << " distances)" << std::endl;
+    }
+    else std::cout << "(s): " << params.s << std::endl;
+    std::cout << "Internal Links (0:False 1:True): " << params.INTERNAL << std::endl;
+    if(params.arrival_rate>0 || params.departure_rate>0){
+        std::cout << "Open system: arrivals at rate " << params.arrival_rate << ", departures at rate " << params.departure_rate << " per cluster";
+        if(params.t_max>0) std::cout << ", until t = " << params.t_max;
+        std::cout << std::endl;
+    }
+    if(params.clones>0){
+        std::cout << "Clones: " << params.clones << " per realization at";
+        if(params.clone_at_nc>0) std::cout << " Nc <= " << params.clone_at_nc;
+        if(params.clone_at_nc>0 && params.clone_at_t>0) std::cout << " or";
+        if(params.clone_at_t>0) std::cout << " t >= " << params.clone_at_t;
+        std::cout << std::endl;
+    }
+    if(params.seed >= 0) std::cout << "Seed: " << params.seed << std::endl;
+    if(params.lanes > 1) std::cout << "Engine: ensemble of " << params.lanes << " lanes" << std::endl;
+    else if(effective_engine(params)=="rejection") std::cout << "Engine: rejection (matrix below acceptance " << params.min_acceptance << ")" << std::endl;
+    else std::cout << "Engine: " << effective_engine(params) << std::endl;
+    if(effective_engine(params)=="matrix" || effective_engine(params)=="rejection"){
+        std::cout << "Softmax: " << params.softmax;
+        if(params.softmax=="fast") std::cout << " (" << FastExp::isa_name() << ")";
+        std::cout << std::endl;
+    }
+    std::string backing_dir = propensity_storage(params, s_list.size()>0);
+    std::cout << "Propensity storage: " << (backing_dir.length()>0 ? "memory mapped in " + backing_dir : "memory") << std::endl;
+    if(params.status_path.length()>0) std::cout << "Status file: " << params.status_path << std::endl;
+    std::cout << "Placement: " << placement_report(params);
 
     std::cout << "--------------------------------------------------------------" << std::endl;
     std::cout << "\t\t DIRECTORIES"  << std::endl;
     std::cout << "--------------------------------------------------------------" << std::endl;
-    std::cout << "WRITTING DATA TO : " << data_folder<< "/" <<std::endl;
+    if(s_list.size()>0) for(auto &folder : s_folders) std::cout << "WRITTING DATA TO : " << folder << "/" <<std::endl;
+    else std::cout << "WRITTING DATA TO : " << data_folder<< "/" <<std::endl;
     std::cout << "FILENAMES: " << time_str << std::endl;
     std::cout << "--------------------------------------------------------------" << std::endl;
     std::cout << "\t\t SIMULATION START"  << std::endl;
@@ -201,20 +343,21 @@ void print_two(){
 //////////////////////////////////////////////////////////////////////////////////////////////////////
 void dev(){
 
-    N_rels =1;
+    params.N_rels =1;
 
     //Input
-    D= 2;
-    N = 10;
-    s = 0.8293;
-    INTERNAL=false;
+    params.D= 2;
+    params.N = 10;
+    params.s = 0.8293;
+    params.INTERNAL=false;
 
     dir = "out/test/";
 
     set_dirs();
     print_two();
 
-    run_sim(0);
+    CsvSink sink(data_folder, time_str);
+    run_simulation(params, sink);
 
 }
 //////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "OutputReader.hpp"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//                          READER OF THE OUTPUT FILES
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+// Input should be of the form:
+//  ./TPread.out command [arguments] edge_files...
+//      info                    N, D, links, steps, final time and index of every file
+//      index K                 writes the index of every file, a checkpoint every K links
+//                              (<prefix>-<rel>.edge.idx next to the edge file)
+//      clusters T              number of clusters of every file at time T
+//      partition T             NodeLabel,Cluster of every agent at time T (one file), the
+//                              cluster is named after its smallest member
+//      merge I J               link that put agents I and J in the same cluster (one file),
+//                              step -1 if it never happens
+//  the results are written to stdout as csv. With an index a query replays at most K links,
+//  without one every link from the start.
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+void usage();
+int n_arguments(const std::string &command);
+
+int main(int argc, char **argv){
+
+    if(argc < 3){
+        usage();
+        return 1;
+    }
+    std::string command = argv[1];
+    int n_args = n_arguments(command);
+    if(n_args < 0){
+        usage();
+        return 1;
+    }
+    std::vector<std::string> args(argv + 2, argv + std::min(argc, 2 + n_args));
+    std::vector<std::string> files(argv + std::min(argc, 2 + n_args), argv + argc);
+    if((int) args.size() != n_args || files.empty()){
+        usage();
+        return 1;
+    }
+
+    try{
+        if(command=="info"){
+            std::cout << "File,N,D,Links,Steps,Time,Index" << std::endl;
+            for(const std::string &f : files){
+                RealizationReader r(f);
+                std::cout << f << "," << r.N << "," << r.D << "," << r.n_links() << "," << r.steps << "," << r.t_end
+                          << "," << r.index_interval() << std::endl;
+            }
+        }
+        else if(command=="index"){
+            int k = std::stoi(args[0]);
+            for(const std::string &f : files){
+                RealizationReader r(f);
+                r.write_index(k);
+                std::cerr << "indexed " << f << " (" << r.n_links() << " links)" << std::endl;
+            }
+        }
+        else if(command=="clusters"){
+            double t = std::stod(args[0]);
+            std::cout << "File,Time,Clusters" << std::endl;
+            for(const std::string &f : files){
+                RealizationReader r(f);
+                std::cout << f << "," << t << "," << r.partition_at(t).n_clusters() << std::endl;
+            }
+        }
+        else if(command=="partition"){
+            if(files.size() != 1) throw std::invalid_argument("partition takes one file");
+            RealizationReader r(files[0]);
+            Partition p = r.partition_at(std::stod(args[0]));
+            std::cout << "NodeLabel,Cluster" << std::endl;
+            for(int i=0; i<p.size(); i++) std::cout << i << "," << p.cluster(i) << "\n";
+            std::cout.flush();
+        }
+        else if(command=="merge"){
+            if(files.size() != 1) throw std::invalid_argument("merge takes one file");
+            RealizationReader r(files[0]);
+            Link l;
+            r.merge_step(std::stoi(args[0]), std::stoi(args[1]), l);
+            std::cout << "Node1,Node2,Step,Time" << std::endl;
+            std::cout << l.a1 << "," << l.a2 << "," << l.step << "," << l.t << std::endl;
+        }
+    }
+    catch(const std::exception &e){
+        std::cerr << "error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+int n_arguments(const std::string &command){
+    if(command=="info") return 0;
+    if(command=="index" || command=="clusters" || command=="partition") return 1;
+    if(command=="merge") return 2;
+    return -1;
+}
+
+void usage(){
+    std::cerr << "usage: TPread.out command [arguments] edge_files...\n"
+              << "  info                 N, D, links, steps, final time and index of every file\n"
+              << "  index K              writes the index of every file (a checkpoint every K links)\n"
+              << "  clusters T           number of clusters of every file at time T\n"
+              << "  partition T          cluster of every agent at time T (one file)\n"
+              << "  merge I J            link that put I and J in the same cluster (one file)" << std::endl;
+}
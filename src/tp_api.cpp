@@ -0,0 +1,190 @@
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "tp_api.h"
+#include "Simulation.hpp"
+
+//----------------------------------------------
+static thread_local std::string last_error;
+
+static SimParams to_params(const tp_params *p){
+    SimParams params;
+    params.N_rels = p->n_rels;
+    params.D = p->D;
+    params.N = p->N;
+    params.s = p->s;
+    params.INTERNAL = (p->internal != 0);
+    params.seed = p->seed;
+    params.engine = (p->engine != nullptr) ? p->engine : "matrix";
+    params.rel_threads = p->rel_threads;
+    params.lanes = p->lanes;
+    params.n_threads = p->n_threads;
+    params.mem_budget = p->mem_budget;
+    params.mmap_dir = (p->mmap_dir != nullptr) ? p->mmap_dir : "";
+    params.pin = (p->pin != 0);
+    params.huge_pages = (p->huge_pages != 0);
+    params.matrix_cache = (p->matrix_cache != nullptr) ? p->matrix_cache : "";
+    params.softmax = (p->softmax != nullptr) ? p->softmax : "fast";
+    params.compact_below = p->compact_below;
+    params.min_acceptance = p->min_acceptance;
+    params.arrival_rate = p->arrival_rate;
+    params.departure_rate = p->departure_rate;
+    params.t_max = p->t_max;
+    params.clones = p->clones;
+    params.clone_at_nc = p->clone_at_nc;
+    params.clone_at_t = p->clone_at_t;
+    params.status_path = (p->status_path != nullptr) ? p->status_path : "";
+    params.status_interval = p->status_interval;
+    params.progress = (p->progress != 0);
+    return params;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//  CALLBACK SINK
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+class CallbackRealization : public RealizationSink{
+    tp_callbacks cb;
+    int rel;
+public:
+    CallbackRealization(const tp_callbacks &cb_, int rel_): cb(cb_), rel(rel_){}
+    void link(int a1, int a2, int step, long double t) override{
+        if(cb.link) cb.link(cb.user, rel, a1, a2, step, (double) t);
+    }
+    void arrive(int label, int step, long double t, const double *character) override{
+        if(cb.arrive) cb.arrive(cb.user, rel, label, step, (double) t, character);
+    }
+    void depart(int label, int step, long double t) override{
+        if(cb.depart) cb.depart(cb.user, rel, label, step, (double) t);
+    }
+    void end(int steps, long double t) override{
+        if(cb.end) cb.end(cb.user, rel, steps, (double) t);
+    }
+};
+
+class CallbackSink : public SimSink{
+    tp_callbacks cb;
+public:
+    CallbackSink(const tp_callbacks &cb_): cb(cb_){}
+    std::unique_ptr<RealizationSink> start(int rel, int N, int D, const double *characters) override{
+        if(cb.start) cb.start(cb.user, rel, N, D, characters);
+        return std::unique_ptr<RealizationSink>(new CallbackRealization(cb, rel));
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//  RUNS
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+extern "C" void tp_params_default(tp_params *params){
+    SimParams d;
+    params->n_rels = d.N_rels;
+    params->D = d.D;
+    params->N = d.N;
+    params->s = (double) d.s;
+    params->internal = d.INTERNAL ? 1 : 0;
+    params->seed = d.seed;
+    params->engine = nullptr;
+    params->rel_threads = d.rel_threads;
+    params->lanes = d.lanes;
+    params->n_threads = d.n_threads;
+    params->mem_budget = (double) d.mem_budget;
+    params->mmap_dir = nullptr;
+    params->pin = d.pin ? 1 : 0;
+    params->huge_pages = d.huge_pages ? 1 : 0;
+    params->matrix_cache = nullptr;
+    params->softmax = nullptr;
+    params->compact_below = d.compact_below;
+    params->min_acceptance = d.min_acceptance;
+    params->arrival_rate = (double) d.arrival_rate;
+    params->departure_rate = (double) d.departure_rate;
+    params->t_max = (double) d.t_max;
+    params->clones = d.clones;
+    params->clone_at_nc = d.clone_at_nc;
+    params->clone_at_t = (double) d.clone_at_t;
+    params->status_path = nullptr;
+    params->status_interval = d.status_interval;
+    params->progress = d.progress ? 1 : 0;
+}
+
+extern "C" int tp_run(const tp_params *params, const tp_callbacks *callbacks){
+    try{
+        CallbackSink sink(*callbacks);
+        run_simulation(to_params(params), sink);
+        return 0;
+    }
+    catch(const std::exception &e){ last_error = e.what(); }
+    catch(...){ last_error = "unknown error"; }
+    return -1;
+}
+
+extern "C" int tp_run_csv(const tp_params *params, const char *folder, const char *prefix){
+    try{
+        CsvSink sink(folder, prefix);
+        run_simulation(to_params(params), sink);
+        return 0;
+    }
+    catch(const std::exception &e){ last_error = e.what(); }
+    catch(...){ last_error = "unknown error"; }
+    return -1;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+//  BATCHES
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+struct tp_batch{
+    BatchRunner runner;
+    std::mutex m;
+    std::map<int, std::future<void>> jobs;
+    int next_job = 0;
+
+    tp_batch(int n_workers): runner(n_workers){}
+};
+
+extern "C" tp_batch *tp_batch_create(int n_workers){
+    try{ return new tp_batch(n_workers); }
+    catch(const std::exception &e){ last_error = e.what(); }
+    return nullptr;
+}
+
+extern "C" int tp_batch_submit(tp_batch *batch, const tp_params *params, const tp_callbacks *callbacks){
+    try{
+        std::future<void> f = batch->runner.submit(to_params(params), std::make_shared<CallbackSink>(*callbacks));
+        std::lock_guard<std::mutex> lock(batch->m);
+        int job = batch->next_job++;
+        batch->jobs[job] = std::move(f);
+        return job;
+    }
+    catch(const std::exception &e){ last_error = e.what(); }
+    return -1;
+}
+
+extern "C" int tp_batch_wait(tp_batch *batch, int job){
+    std::future<void> f;
+    {
+        std::lock_guard<std::mutex> lock(batch->m);
+        auto it = batch->jobs.find(job);
+        if(it == batch->jobs.end()){
+            last_error = "unknown job " + std::to_string(job);
+            return -1;
+        }
+        f = std::move(it->second);
+        batch->jobs.erase(it);
+    }
+    try{
+        f.get();
+        return 0;
+    }
+    catch(const std::exception &e){ last_error = e.what(); }
+    catch(...){ last_error = "unknown error"; }
+    return -1;
+}
+
+extern "C" void tp_batch_destroy(tp_batch *batch){
+    //the runner finishes the queued jobs before its threads stop
+    delete batch;
+}
+
+extern "C" const char *tp_last_error(void){
+    return last_error.c_str();
+}
@@ -0,0 +1,84 @@
+/*
+  Description: C interface of the simulator (library TPsim), see Simulation.hpp.
+
+  All the functions are reentrant. Errors return -1, tp_last_error() gives the
+  message of the last error of the calling thread.
+*/
+
+#ifndef tp_api_h
+#define tp_api_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct tp_params{
+  int n_rels;               /* number of realizations */
+  int D;                    /* dimension of the characters */
+  int N;                    /* number of agents */
+  double s;                 /* selectivity */
+  int internal;             /* 1 -> links inside clusters */
+  long long seed;           /* realization rel uses seed + rel, -1 -> seeds from the clock */
+
+  const char *engine;       /* "matrix", "rowsum", "uniform" (s = 0) or "rejection", NULL -> "matrix" */
+  int rel_threads;          /* threads inside one realization */
+  int lanes;                /* 1, 4, 8 or 16 realizations in lockstep per thread */
+  int n_threads;            /* threads of the run, 0 -> OpenMP default */
+  double mem_budget;        /* GB for the propensity matrices, 0 -> no limit */
+  const char *mmap_dir;     /* scratch directory when over budget, NULL -> temp directory */
+  int pin;                  /* 1 -> threads pinned to cpus, grouped by NUMA node (Linux) */
+  int huge_pages;           /* 1 -> transparent huge pages for the matrices (Linux) */
+  const char *matrix_cache; /* directory of the cached initialized matrices, NULL -> none */
+  const char *softmax;      /* "fast" or "long" exp of the matrix normalization, NULL -> "fast" */
+  double compact_below;     /* no internal links: compacted matrix below this live fraction, 0 -> never */
+  double min_acceptance;    /* rejection engine: acceptance below which it switches to a matrix */
+  double arrival_rate;      /* open system: new agents per unit time (matrix engine) */
+  double departure_rate;    /* open system: departures per cluster and unit time */
+  double t_max;             /* end of the open realizations, 0 -> none (needed with arrivals) */
+  int clones;               /* continuations of every realization from the clone point, 0 -> none */
+  int clone_at_nc;          /* clone point: Nc <= clone_at_nc (0 -> not used) */
+  double clone_at_t;        /*              or t >= clone_at_t (0 -> not used) */
+
+  const char *status_path;  /* status file (JSON) replaced every status_interval, NULL -> none */
+  double status_interval;   /* seconds between two reports */
+  int progress;             /* 1 -> one line per report on stderr */
+} tp_params;
+
+/* called from the simulation threads, concurrently for different realizations */
+typedef struct tp_callbacks{
+  void (*start)(void *user, int rel, int N, int D, const double *characters);
+  void (*link)(void *user, int rel, int a1, int a2, int step, double t);
+  void (*end)(void *user, int rel, int steps, double t);
+  void *user;
+  /* open systems (after user, the fields above keep their positions): an agent arrives
+     (labels N, N+1, ...) with its D characters, valid during the call; an agent leaves with
+     its cluster (one call per agent) */
+  void (*arrive)(void *user, int rel, int label, int step, double t, const double *character);
+  void (*depart)(void *user, int rel, int label, int step, double t);
+} tp_callbacks;
+
+void tp_params_default(tp_params *params);
+
+/* runs all the realizations, returns when they are done */
+int tp_run(const tp_params *params, const tp_callbacks *callbacks);
+/* same, writing the csv files of TP.out in folder */
+int tp_run_csv(const tp_params *params, const char *folder, const char *prefix);
+
+/* batches: the runs are queued and executed by n_workers threads */
+typedef struct tp_batch tp_batch;
+
+tp_batch *tp_batch_create(int n_workers);
+/* returns the job id (>= 0); callbacks must stay valid until the job is waited for */
+int tp_batch_submit(tp_batch *batch, const tp_params *params, const tp_callbacks *callbacks);
+/* waits for a job, returns its status (0 ok, -1 error) */
+int tp_batch_wait(tp_batch *batch, int job);
+/* waits for all the submitted jobs and frees the batch */
+void tp_batch_destroy(tp_batch *batch);
+
+const char *tp_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* tp_api_h */